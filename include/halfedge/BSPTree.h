@@ -0,0 +1,77 @@
+#pragma once
+
+#include "halfedge/Polyhedron.h"
+#include "halfedge/noncopyable.h"
+
+#include <SM_Vector.h>
+#include <SM_Plane.h>
+
+#include <vector>
+
+namespace he
+{
+
+class Polyhedron;
+
+// Solid-leaf bsp of a closed polyhedron, built from its face planes.
+// Build once per operand and reuse it for many booleans, the solids
+// can be concave and the faces can have holes, the pieces are cut by
+// Polyhedron::Fork.
+class BSPTree : noncopyable
+{
+public:
+    BSPTree(const Polyhedron& solid);
+
+    // split a convex poly with the tree,
+    // append the pieces inside and outside the solid
+    void Split(const Polyhedron& convex, std::vector<PolyhedronPtr>* inside,
+        std::vector<PolyhedronPtr>* outside) const;
+
+    // convex pieces of the solid
+    auto& GetCells() const { return m_cells; }
+
+    // boolean, return convex fragments
+    static std::vector<PolyhedronPtr> Union(const BSPTree& a, const BSPTree& b);
+    static std::vector<PolyhedronPtr> Intersect(const BSPTree& a, const BSPTree& b);
+    static std::vector<PolyhedronPtr> Subtract(const BSPTree& a, const BSPTree& b);
+
+    // streaming, the cells are split in batches, cancel is checked by cell
+    static void Union(const BSPTree& a, const BSPTree& b, const Polyhedron::FragmentSink& sink,
+        CancelToken* cancel = nullptr);
+    static void Intersect(const BSPTree& a, const BSPTree& b, const Polyhedron::FragmentSink& sink,
+        CancelToken* cancel = nullptr);
+    static void Subtract(const BSPTree& a, const BSPTree& b, const Polyhedron::FragmentSink& sink,
+        CancelToken* cancel = nullptr);
+
+private:
+    struct Face
+    {
+        std::vector<sm::vec3> border;
+        sm::Plane plane;
+    };
+
+    int Build(const std::vector<Face>& faces);
+
+    static void SplitCells(const std::vector<PolyhedronPtr>& cells, const BSPTree& tree,
+        bool inside, const Polyhedron::FragmentSink& sink, CancelToken* cancel);
+
+private:
+    static const int LEAF_IN  = -1;
+    static const int LEAF_OUT = -2;
+
+    struct Node
+    {
+        sm::Plane plane;
+
+        // node index or leaf
+        int front, back;
+    };
+
+    std::vector<Node> m_nodes;
+    int m_root = LEAF_OUT;
+
+    std::vector<PolyhedronPtr> m_cells;
+
+}; // BSPTree
+
+}
\ No newline at end of file
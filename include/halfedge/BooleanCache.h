@@ -0,0 +1,97 @@
+#pragma once
+
+#include "halfedge/Polyhedron.h"
+#include "halfedge/noncopyable.h"
+
+#include <SM_Plane.h>
+
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+namespace he
+{
+
+// Bounded LRU cache in front of the booleans and Clip, keyed by the
+// operands' GetHash() and the arguments. A hit is only taken if the stored
+// operands are structurally equal to the given ones. Results are stored and
+// handed out as fresh copies, so callers may edit them. Safe to share
+// between threads.
+class BooleanCache : noncopyable
+{
+public:
+    BooleanCache(size_t capacity);
+
+    std::vector<PolyhedronPtr> Union(const Polyhedron& a, const Polyhedron& b, bool merge = false);
+    PolyhedronPtr Intersect(const Polyhedron& a, const Polyhedron& b);
+    std::vector<PolyhedronPtr> Subtract(const Polyhedron& a, const Polyhedron& b, bool merge = false);
+
+    // returns a clipped copy of poly, nullptr if Clip() fails
+    PolyhedronPtr Clip(const Polyhedron& poly, const sm::Plane& plane, Polyhedron::KeepType keep, bool seam_face = false);
+
+    size_t GetHits() const   { return m_hits; }
+    size_t GetMisses() const { return m_misses; }
+
+    void Clear();
+
+private:
+    enum class Op
+    {
+        Union,
+        Intersect,
+        Subtract,
+        Clip,
+    };
+
+    struct Key
+    {
+        Op op;
+        size_t a, b;
+        size_t a_verts, b_verts;
+        float plane[4];
+        int flags;
+
+        bool operator == (const Key& key) const;
+    };
+
+    struct KeyHash
+    {
+        size_t operator () (const Key& key) const;
+    };
+
+    struct Entry
+    {
+        Key key;
+        // operands, to rule out hash collisions
+        PolyhedronPtr a, b;
+        bool succ;
+        std::vector<PolyhedronPtr> polys;
+    };
+
+    bool Query(const Key& key, const Polyhedron& a, const Polyhedron* b,
+        bool& succ, std::vector<PolyhedronPtr>& polys);
+    void Insert(const Key& key, const Polyhedron& a, const Polyhedron* b,
+        bool succ, const std::vector<PolyhedronPtr>& polys);
+
+    static Key MakeKey(Op op, const Polyhedron& a, const Polyhedron* b, int flags);
+
+    static bool IsSame(const Polyhedron& a, const Polyhedron& b);
+
+    static std::vector<PolyhedronPtr> Copy(const std::vector<PolyhedronPtr>& polys);
+
+private:
+    size_t m_capacity;
+
+    // front is the most recent
+    std::list<Entry> m_entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_key2entry;
+
+    std::mutex m_mtx;
+
+    std::atomic<size_t> m_hits{ 0 };
+    std::atomic<size_t> m_misses{ 0 };
+
+}; // BooleanCache
+
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "halfedge/typedef.h"
+#include "halfedge/noncopyable.h"
+
+#include <SM_Cube.h>
+
+#include <vector>
+
+namespace he
+{
+
+// Deferred boolean expression, nothing is cut until Evaluate.
+// Operands with disjoint boxes are skipped, chains of the same op are
+// flattened and reordered, and the nodes shared in the tree are evaluated once.
+class CSGNode : noncopyable
+{
+public:
+    enum class Type
+    {
+        Leaf,
+        Union,
+        Intersect,
+        Subtract,
+    };
+
+public:
+    static CSGNodePtr Leaf(const PolyhedronPtr& poly);
+
+    static CSGNodePtr Union(const CSGNodePtr& a, const CSGNodePtr& b);
+    static CSGNodePtr Intersect(const CSGNodePtr& a, const CSGNodePtr& b);
+    static CSGNodePtr Subtract(const CSGNodePtr& a, const CSGNodePtr& b);
+
+    Type GetType() const { return m_type; }
+
+    auto& GetPoly() const { return m_poly; }
+    auto& GetChildren() const { return m_children; }
+
+    // bound of the result, may be larger, from the leaves' current boxes
+    sm::cube GetAABB() const;
+
+    // return fragments, merge: see Polyhedron::MergeFragments
+    std::vector<PolyhedronPtr> Evaluate(bool merge = false) const;
+
+private:
+    CSGNode(Type type);
+
+private:
+    Type m_type;
+
+    PolyhedronPtr m_poly;
+    std::vector<CSGNodePtr> m_children;
+
+}; // CSGNode
+
+}
\ No newline at end of file
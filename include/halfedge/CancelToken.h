@@ -0,0 +1,71 @@
+#pragma once
+
+#include "halfedge/noncopyable.h"
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+
+namespace he
+{
+
+// Cancel flag and deadline for long operations, checked at cheap points.
+// A cancelled operation leaves its inputs untouched and returns empty,
+// the progress tells how far it went.
+class CancelToken : noncopyable
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+public:
+    CancelToken() {}
+
+    // from any thread
+    void Cancel() { m_cancelled = true; }
+
+    // from any thread
+    void SetDeadline(Clock::time_point deadline) {
+        m_deadline = deadline.time_since_epoch().count();
+    }
+    // counted from now
+    void SetTimeBudget(Clock::duration budget) {
+        SetDeadline(Clock::now() + budget);
+    }
+
+    bool IsCancelled() const {
+        if (!m_cancelled && Clock::now().time_since_epoch().count() >= m_deadline) {
+            m_cancelled = true;
+        }
+        return m_cancelled;
+    }
+
+    // units finished: planes in Subtract, cells in the bsp booleans,
+    // verts in Fuse and faces in Extrude
+    size_t GetProgress() const { return m_progress; }
+
+    void Reset() {
+        m_cancelled = false;
+        m_deadline = NO_DEADLINE;
+        m_progress = 0;
+    }
+
+    // called by the operations, count the finished units, false to stop
+    bool Check(size_t done = 1) {
+        m_progress += done;
+        return !IsCancelled();
+    }
+
+private:
+    static constexpr Clock::rep NO_DEADLINE = std::numeric_limits<Clock::rep>::max();
+
+private:
+    mutable std::atomic<bool> m_cancelled{ false };
+
+    // in ticks, one atomic so the flag and time can't tear
+    std::atomic<Clock::rep> m_deadline{ NO_DEADLINE };
+
+    std::atomic<size_t> m_progress{ 0 };
+
+}; // CancelToken
+
+}
\ No newline at end of file
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "halfedge/HalfEdge.h"
+
+namespace he
+{
+
+// the half-edges out of a vertex, walk the fan by prev->twin from the start,
+// at an open edge go on from the start the other way by twin->next,
+// only the fan of the start edge, so the verts are taken as manifold
+template<typename T>
+class OutEdgeCirculator
+{
+public:
+    class Iterator
+    {
+    public:
+        Iterator(Edge<T>* start, Edge<T>* curr) : m_start(start), m_curr(curr) {}
+
+        Edge<T>* operator * () const { return m_curr; }
+        Iterator& operator ++ ()
+        {
+            if (m_backward) {
+                m_curr = m_curr->twin ? m_curr->twin->next : nullptr;
+                return *this;
+            }
+
+            auto next = m_curr->prev->twin;
+            if (next == m_start) {
+                m_curr = nullptr;
+            } else if (next) {
+                m_curr = next;
+            } else {
+                m_backward = true;
+                m_curr = m_start->twin ? m_start->twin->next : nullptr;
+            }
+            return *this;
+        }
+        bool operator != (const Iterator& itr) const { return m_curr != itr.m_curr; }
+
+    private:
+        Edge<T>* m_start;
+        Edge<T>* m_curr;
+
+        bool m_backward = false;
+
+    }; // Iterator
+
+    OutEdgeCirculator(Edge<T>* start) : m_start(start) {}
+
+    Iterator begin() const { return Iterator(m_start, m_start); }
+    Iterator end() const { return Iterator(m_start, nullptr); }
+
+private:
+    Edge<T>* m_start;
+
+}; // OutEdgeCirculator
+
+// the half-edges of a loop by next, open polylines end at nullptr
+template<typename T>
+class LoopEdgeCirculator
+{
+public:
+    class Iterator
+    {
+    public:
+        Iterator(Edge<T>* start, Edge<T>* curr) : m_start(start), m_curr(curr) {}
+
+        Edge<T>* operator * () const { return m_curr; }
+        Iterator& operator ++ () {
+            m_curr = m_curr->next == m_start ? nullptr : m_curr->next;
+            return *this;
+        }
+        bool operator != (const Iterator& itr) const { return m_curr != itr.m_curr; }
+
+    private:
+        Edge<T>* m_start;
+        Edge<T>* m_curr;
+
+    }; // Iterator
+
+    LoopEdgeCirculator(Edge<T>* start) : m_start(start) {}
+
+    Iterator begin() const { return Iterator(m_start, m_start); }
+    Iterator end() const { return Iterator(m_start, nullptr); }
+
+private:
+    Edge<T>* m_start;
+
+}; // LoopEdgeCirculator
+
+// the border then the holes, Face has the members: border, holes
+template<typename Face>
+class FaceLoopRange
+{
+public:
+    using LoopPtr = decltype(Face::border);
+
+    class Iterator
+    {
+    public:
+        Iterator(const Face& face, size_t idx) : m_face(face), m_idx(idx) {}
+
+        LoopPtr operator * () const { return m_idx == 0 ? m_face.border : m_face.holes[m_idx - 1]; }
+        Iterator& operator ++ () {
+            ++m_idx;
+            return *this;
+        }
+        bool operator != (const Iterator& itr) const { return m_idx != itr.m_idx; }
+
+    private:
+        const Face& m_face;
+        size_t m_idx;
+
+    }; // Iterator
+
+    FaceLoopRange(const Face& face) : m_face(face) {}
+
+    Iterator begin() const { return Iterator(m_face, m_face.border ? 0 : 1); }
+    Iterator end() const { return Iterator(m_face, m_face.holes.size() + 1); }
+
+private:
+    const Face& m_face;
+
+}; // FaceLoopRange
+
+template<typename T>
+OutEdgeCirculator<T> out_edges(const Vertex<T>& vert) {
+    return OutEdgeCirculator<T>(vert.edge);
+}
+template<typename T>
+OutEdgeCirculator<T> out_edges(Edge<T>* edge) {
+    return OutEdgeCirculator<T>(edge);
+}
+
+template<typename T>
+LoopEdgeCirculator<T> loop_edges(const Loop<T>& loop) {
+    return LoopEdgeCirculator<T>(loop.edge);
+}
+
+template<typename Face>
+FaceLoopRange<Face> face_loops(const Face& face) {
+    return FaceLoopRange<Face>(face);
+}
+
+}
\ No newline at end of file
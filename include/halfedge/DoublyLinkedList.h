@@ -18,10 +18,39 @@ public:
     T* Head() const { return m_head; }
     size_t Size() const { return m_size; }
 
+    // range-for from the head, the current item must stay linked until the step
+    class Iterator
+    {
+    public:
+        Iterator(T* head, T* curr) : m_head(head), m_curr(curr) {}
+
+        T* operator * () const { return m_curr; }
+        Iterator& operator ++ () {
+            m_curr = m_curr->linked_next == m_head ? nullptr : m_curr->linked_next;
+            return *this;
+        }
+        bool operator != (const Iterator& itr) const { return m_curr != itr.m_curr; }
+
+    private:
+        T* m_head;
+        T* m_curr;
+
+    }; // Iterator
+
+    Iterator begin() const { return Iterator(m_head, m_head); }
+    Iterator end() const { return Iterator(m_head, nullptr); }
+
     void Clear();
 
     DoublyLinkedList& Connect(DoublyLinkedList& list);
 
+    // move the items which pred(item) is false to the end of list, in one pass
+    template<typename Pred>
+    void Partition(Pred pred, DoublyLinkedList& list);
+
+    // only for restoring a list whose items' links were restored outside
+    void Reset(T* head, size_t size);
+
 private:
     bool Check();
     bool CheckLinks();
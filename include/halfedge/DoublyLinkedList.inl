@@ -127,6 +127,76 @@ DoublyLinkedList<T>::Connect(DoublyLinkedList& list)
     return *this;
 }
 
+template <typename T>
+template <typename Pred>
+void DoublyLinkedList<T>::Partition(Pred pred, DoublyLinkedList& list)
+{
+    if (!m_head) {
+        return;
+    }
+
+    T* keep_head = nullptr;
+    T* keep_tail = nullptr;
+    size_t keep_size = 0;
+
+    DoublyLinkedList moved;
+    T* moved_tail = nullptr;
+
+    auto item = m_head;
+    for (size_t i = 0, n = m_size; i < n; ++i)
+    {
+        auto next = item->linked_next;
+        if (pred(item))
+        {
+            if (keep_tail) {
+                keep_tail->linked_next = item;
+                item->linked_prev = keep_tail;
+            } else {
+                keep_head = item;
+            }
+            keep_tail = item;
+            ++keep_size;
+        }
+        else
+        {
+            if (moved_tail) {
+                moved_tail->linked_next = item;
+                item->linked_prev = moved_tail;
+            } else {
+                moved.m_head = item;
+            }
+            moved_tail = item;
+            ++moved.m_size;
+        }
+        item = next;
+    }
+
+    if (keep_head) {
+        keep_tail->linked_next = keep_head;
+        keep_head->linked_prev = keep_tail;
+    }
+    m_head = keep_head;
+    m_size = keep_size;
+
+    if (moved.m_head) {
+        moved_tail->linked_next = moved.m_head;
+        moved.m_head->linked_prev = moved_tail;
+    }
+
+    assert(Check());
+
+    list.Connect(moved);
+}
+
+template <typename T>
+void DoublyLinkedList<T>::Reset(T* head, size_t size)
+{
+    m_head = head;
+    m_size = size;
+
+    assert(Check());
+}
+
 template <typename T>
 bool DoublyLinkedList<T>::Check()
 {
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "halfedge/DoublyLinkedList.h"
+#include "halfedge/HalfEdge.h"
+#include "halfedge/Polyhedron.h"
+#include "halfedge/noncopyable.h"
+
+#include <SM_Cube.h>
+
+#include <vector>
+#include <unordered_map>
+
+namespace he
+{
+
+// Undo log for Polyhedron edits.
+// Every element is snapshotted on its first touch, new elements are
+// recorded and deletions are deferred, so both Commit and Rollback
+// cost O(edited elements) instead of O(mesh).
+class EditLog : noncopyable
+{
+public:
+    EditLog(Polyhedron& poly);
+    ~EditLog();
+
+    // call before modifying any field of the element,
+    // include the linked_prev / linked_next of list neighbors
+    void Touch(vert3* vert) { Touch(m_verts, vert); }
+    void Touch(edge3* edge) { Touch(m_edges, edge); }
+    void Touch(loop3* loop) { Touch(m_loops, loop); }
+
+    // element created in this transaction
+    void Add(vert3* vert) { m_verts.added.push_back(vert); }
+    void Add(edge3* edge) { m_edges.added.push_back(edge); }
+    void Add(loop3* loop) { m_loops.added.push_back(loop); }
+
+    // element removed from its list, the delete is deferred to Commit
+    void Delete(vert3* vert) { m_verts.deleted.push_back(vert); }
+    void Delete(edge3* edge) { m_edges.deleted.push_back(edge); }
+    void Delete(loop3* loop) { m_loops.deleted.push_back(loop); }
+
+    // faces
+    void AppendFace();
+    void EraseFace(size_t idx, const Polyhedron::Face& face);
+
+    void Commit();
+    void Rollback();
+
+private:
+    template<typename T>
+    struct Record
+    {
+        Record(DoublyLinkedList<T>& list)
+            : list(list)
+            , head(list.Head())
+            , size(list.Size())
+        {
+        }
+
+        DoublyLinkedList<T>& list;
+        T*     head;
+        size_t size;
+
+        std::unordered_map<T*, T> old;
+
+        std::vector<T*> added;
+        std::vector<T*> deleted;
+    };
+
+    template<typename T>
+    static void Touch(Record<T>& rec, T* item) {
+        if (item) {
+            rec.old.insert({ item, *item });
+        }
+    }
+
+    template<typename T>
+    static void Commit(Record<T>& rec);
+    template<typename T>
+    static void Rollback(Record<T>& rec);
+
+private:
+    Polyhedron& m_poly;
+
+    Record<vert3> m_verts;
+    Record<edge3> m_edges;
+    Record<loop3> m_loops;
+
+    // faces ops, replayed backward on rollback
+    struct FaceOp
+    {
+        bool   erase;
+        size_t idx;
+        Polyhedron::Face face;
+    };
+    std::vector<FaceOp> m_face_ops;
+
+    sm::cube m_aabb;
+
+    size_t m_next_vert_id;
+    size_t m_next_edge_id;
+    size_t m_next_loop_id;
+
+    bool m_finished = false;
+
+}; // EditLog
+
+}
\ No newline at end of file
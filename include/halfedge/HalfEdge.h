@@ -41,6 +41,9 @@ struct Vertex
 
     EditType type = EditType::Unmod;
 
+    // scratch flag for traversals, reset to 0 when they finish
+    uint32_t mark = 0;
+
 }; // Vertex
 
 template<typename T>
@@ -76,6 +79,9 @@ struct Edge
 
     EditType type = EditType::Unmod;
 
+    // scratch flag for traversals, reset to 0 when they finish
+    uint32_t mark = 0;
+
 }; // Edge
 
 template<typename T>
@@ -98,6 +104,9 @@ struct Loop
 
     EditType type = EditType::Unmod;
 
+    // scratch flag for traversals, reset to 0 when they finish
+    uint32_t mark = 0;
+
 }; // Loop
 
 // edge
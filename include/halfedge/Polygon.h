@@ -72,9 +72,9 @@ private:
 
     mutable sm::rect m_aabb;
 
-    static size_t m_next_vert_id;
-    static size_t m_next_edge_id;
-    static size_t m_next_loop_id;
+    size_t m_next_vert_id = 0;
+    size_t m_next_edge_id = 0;
+    size_t m_next_loop_id = 0;
 
 }; // Polygon
 
@@ -12,10 +12,17 @@
 #include <memory>
 #include <tuple>
 #include <map>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <cfloat>
 
 namespace he
 {
 
+class EditLog;
+class CancelToken;
+
 class Polyhedron
 {
 public:
@@ -42,6 +49,7 @@ public:
     Polyhedron(const std::vector<in_vert>& verts, const std::vector<in_face>& faces); // right-hand
     Polyhedron(const std::vector<Face>& faces);
     Polyhedron& operator = (const Polyhedron& poly);
+    ~Polyhedron();
 
 	auto& GetVerts() const { return m_verts; }
     auto& GetEdges() const { return m_edges; }
@@ -49,9 +57,15 @@ public:
 
     auto& GetFaces() const { return m_faces; }
 
-	const sm::cube& GetAABB() const { return m_aabb; }
+    // grown by the added verts, removing a vert on the box leaves it dirty,
+    // then it is recomputed by the next query
+	const sm::cube& GetAABB() const;
 	void UpdateAABB();
 
+    // over the positions and the topology, not the ids, equal for copies,
+    // cached until the next edit, call UpdateAABB after moving verts
+    size_t GetHash() const;
+
     enum class KeepType
     {
         KeepAbove,
@@ -59,25 +73,83 @@ public:
         KeepAll,
     };
     bool Clip(const sm::Plane& plane, KeepType keep, bool seam_face = false);
+    // clip distinct polys in parallel, boxes off the plane skip the clip,
+    // return the polys which keep something, in input order
+    static std::vector<PolyhedronPtr> Clip(const std::vector<PolyhedronPtr>& polys,
+        const sm::Plane& plane, KeepType keep, bool seam_face = false);
 
     std::shared_ptr<Polyhedron> Fork(const sm::Plane& plane);
+    // sew the seams made by Fork
     bool Join(const std::shared_ptr<Polyhedron>& poly);
+    // sew all the coincident boundaries, coincident covers are removed first,
+    // with distance <= 0 nothing is coincident and poly is only moved in
+    bool Join(const std::shared_ptr<Polyhedron>& poly, float distance);
+
+    // transaction, only Clip is recorded, the other edits assert that none is open
+    void BeginTransaction();
+    void Commit();
+    void Rollback();
 
     // boolean
 
-    std::vector<PolyhedronPtr> Union(const Polyhedron& other) const;
+    // merge: sew the fragments sharing faces into solids, see MergeFragments
+    // cancel: return empty once cancelled
+    std::vector<PolyhedronPtr> Union(const Polyhedron& other, bool merge = false,
+        CancelToken* cancel = nullptr) const;
     PolyhedronPtr Intersect(const Polyhedron& other) const;
-    std::vector<PolyhedronPtr> Subtract(const Polyhedron& subtrahend) const;
+    std::vector<PolyhedronPtr> Subtract(const Polyhedron& subtrahend, bool merge = false,
+        CancelToken* cancel = nullptr) const;
+    // subtract the cutters in turn, each fragment is only tested with the cutters
+    // overlapping its box, and the fragments of a round are cut in parallel
+    std::vector<PolyhedronPtr> Subtract(const std::vector<PolyhedronPtr>& subtrahends, bool merge = false,
+        CancelToken* cancel = nullptr) const;
+
+    // streaming, each fragment is passed to the sink once it is final,
+    // in the same order, always on the calling thread,
+    // once cancelled no more fragments are passed
+    using FragmentSink = std::function<void(const PolyhedronPtr& frag)>;
+    void Union(const Polyhedron& other, const FragmentSink& sink, CancelToken* cancel = nullptr) const;
+    void Subtract(const Polyhedron& subtrahend, const FragmentSink& sink, CancelToken* cancel = nullptr) const;
+    void Subtract(const std::vector<PolyhedronPtr>& subtrahends, const FragmentSink& sink,
+        CancelToken* cancel = nullptr) const;
+
+    // one solid for each group of fragments touching on coplanar faces,
+    // the covered parts of the faces are removed and coplanar faces dissolved,
+    // only fragments whose faces are all convex and without holes are merged,
+    // the others are passed through as they are
+    static std::vector<PolyhedronPtr> MergeFragments(const std::vector<PolyhedronPtr>& frags);
+
+    // the curves where the two surfaces cross, without cutting the meshes,
+    // closed curves end at their first vert, return nullptr if none
+    PolylinePtr CalcIntersectCurves(const Polyhedron& other) const;
 
     // edit
 
     void Fill();
 
-    void Fuse(float distance = 0.001f);
-    static PolyhedronPtr Fuse(const std::vector<PolyhedronPtr>& polys, float distance = 0.001f);
+    // return false if cancelled, nothing is changed then,
+    // the neighbor queries run in parallel unless told not to
+    bool Fuse(float distance = 0.001f, CancelToken* cancel = nullptr, bool parallel = true);
+    // copy the polys into one and fuse it, holes are kept, the open edges
+    // meeting at the welded verts are paired, return nullptr if cancelled
+    static PolyhedronPtr Fuse(const std::vector<PolyhedronPtr>& polys, float distance = 0.001f,
+        CancelToken* cancel = nullptr, bool parallel = true);
 
     void UniquePoints();
 
+    // dissolve the edges between coplanar faces and the verts left on straight edges
+    void MergeCoplanarFaces();
+
+    // split the faces into triangles by Utility::TriangulateFace, the holes are joined,
+    // the loop edges are moved to the triangles and the first one keeps the border loop,
+    // a face it gives no triangles for is left unchanged
+    void Triangulate();
+
+    // move each vert toward the average of its one ring by lambda, iterated,
+    // a nonzero mu (e.g. -0.53 with lambda 0.5) adds the taubin inflate step
+    // which keeps the volume, the verts on open edges stay if lock_border
+    void Smooth(size_t iterations, float lambda = 0.5f, float mu = 0.0f, bool lock_border = true);
+
     enum ExtrudeFaceType
     {
         ExtrudeFront = 0,
@@ -85,8 +157,26 @@ public:
         ExtrudeSide,
         ExtrudeMaxCount,
     };
-    bool Extrude(float distance, const std::vector<TopoID>& face_ids,
-        bool create_face[ExtrudeMaxCount], std::vector<Face>* new_faces = nullptr);
+    // return false if cancelled, nothing is changed then
+    bool Extrude(float distance, const std::vector<TopoID>& face_ids, bool create_face[ExtrudeMaxCount],
+        std::vector<Face>* new_faces = nullptr, CancelToken* cancel = nullptr);
+
+    // collapse the cheapest edges by quadric error until target_faces is reached
+    // or the next cost is over max_error (summed squared distances to the planes),
+    // faces with holes and open edges are kept, the remaining elements keep their ids,
+    // a collapse touching a non-convex loop is refused, so meshes with many non-convex
+    // faces barely decimate, return false if cancelled, the edits are undone then
+    bool Decimate(size_t target_faces, float max_error = FLT_MAX, CancelToken* cancel = nullptr);
+
+    // catmull-clark for any polygons, loop for triangles only, the levels are
+    // refined in flat arrays and built into a new poly at the end, with new ids,
+    // return nullptr if a face has holes, or is not a triangle for loop
+    enum class SubdivideType
+    {
+        CatmullClark,
+        Loop,
+    };
+    PolyhedronPtr Subdivide(SubdivideType type, size_t levels = 1) const;
 
     // test
 
@@ -124,6 +214,15 @@ private:
 
     void Clear();
 
+    void CombineAABB(const sm::vec3& pos);
+    void CombineAABB(const sm::cube& aabb);
+    // the vert is being removed
+    void ShrinkAABB(const sm::vec3& pos);
+    void SetAABBDirty();
+
+    // clone the elements of poly to the end of the lists, ids are moved after ours
+    void AppendCopy(const Polyhedron& poly);
+
     void BuildFromCube(const sm::cube& aabb);
     void BuildFromFaces(const std::vector<in_vert>& verts,
         const std::vector<in_face>& faces);
@@ -142,11 +241,20 @@ private:
 
     std::vector<Face> m_faces;
 
-    static size_t m_next_vert_id;
-    static size_t m_next_edge_id;
-    static size_t m_next_loop_id;
+    size_t m_next_vert_id = 0;
+    size_t m_next_edge_id = 0;
+    size_t m_next_loop_id = 0;
+
+	mutable sm::cube m_aabb;
+    mutable std::atomic<bool> m_aabb_dirty{ false };
+    mutable std::mutex m_aabb_mtx;
+
+    // 0 for not computed
+    mutable std::atomic<size_t> m_hash{ 0 };
+
+    EditLog* m_log = nullptr;
 
-	sm::cube m_aabb;
+    friend class EditLog;
 
 }; // Polyhedron
 
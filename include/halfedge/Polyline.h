@@ -28,6 +28,9 @@ public:
 
     void UniquePoints();
 
+    // as Polyhedron::Smooth, along the lines, the ends of open lines stay if lock_ends
+    void Smooth(size_t iterations, float lambda = 0.5f, float mu = 0.0f, bool lock_ends = true);
+
 private:
     void OffsetTopoID(size_t v_off, size_t e_off, size_t f_off);
 
@@ -41,9 +44,9 @@ private:
     DoublyLinkedList<edge3> m_edges;
     DoublyLinkedList<loop3> m_polylines;
 
-    static size_t m_next_vert_id;
-    static size_t m_next_edge_id;
-    static size_t m_next_polyline_id;
+    size_t m_next_vert_id = 0;
+    size_t m_next_edge_id = 0;
+    size_t m_next_polyline_id = 0;
 
 }; // Polyline
 
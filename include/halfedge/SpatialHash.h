@@ -0,0 +1,55 @@
+#pragma once
+
+#include <SM_Vector.h>
+
+#include <vector>
+#include <unordered_map>
+
+namespace he
+{
+
+// uniform grid over positions, items of a cell are chained in a flat array
+template<typename T>
+class SpatialHash
+{
+public:
+    SpatialHash(float cell_size);
+
+    void Reserve(size_t num) { m_items.reserve(num); }
+
+    void Insert(const sm::vec3& pos, const T& val);
+
+    // visit(pos, val) the items closer than distance to pos,
+    // stop and return true when visit returns true
+    template<typename Visit>
+    bool Query(const sm::vec3& pos, float distance, Visit visit) const;
+
+    size_t Size() const { return m_items.size(); }
+
+    void Clear();
+
+private:
+    void CalcCell(const sm::vec3& pos, int cell[3]) const;
+
+    static uint64_t CellKey(int x, int y, int z);
+
+private:
+    static const size_t NIL = static_cast<size_t>(-1);
+
+    struct Item
+    {
+        sm::vec3 pos;
+        T        val;
+        size_t   next;
+    };
+
+    float m_cell_size;
+
+    std::vector<Item> m_items;
+    std::unordered_map<uint64_t, size_t> m_cells;
+
+}; // SpatialHash
+
+}
+
+#include "halfedge/SpatialHash.inl"
\ No newline at end of file
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <assert.h>
+#include <math.h>
+
+namespace he
+{
+
+template <typename T>
+SpatialHash<T>::SpatialHash(float cell_size)
+    : m_cell_size(cell_size)
+{
+    assert(cell_size > 0);
+}
+
+template <typename T>
+void SpatialHash<T>::Insert(const sm::vec3& pos, const T& val)
+{
+    int cell[3];
+    CalcCell(pos, cell);
+
+    const size_t idx = m_items.size();
+    auto ret = m_cells.insert({ CellKey(cell[0], cell[1], cell[2]), idx });
+    if (ret.second) {
+        m_items.push_back({ pos, val, NIL });
+    } else {
+        m_items.push_back({ pos, val, ret.first->second });
+        ret.first->second = idx;
+    }
+}
+
+template <typename T>
+template <typename Visit>
+bool SpatialHash<T>::Query(const sm::vec3& pos, float distance, Visit visit) const
+{
+    const sm::vec3 ext(distance, distance, distance);
+    int min[3], max[3];
+    CalcCell(pos - ext, min);
+    CalcCell(pos + ext, max);
+
+    const float dist_sq = distance * distance;
+    for (int x = min[0]; x <= max[0]; ++x) {
+        for (int y = min[1]; y <= max[1]; ++y) {
+            for (int z = min[2]; z <= max[2]; ++z)
+            {
+                auto itr = m_cells.find(CellKey(x, y, z));
+                if (itr == m_cells.end()) {
+                    continue;
+                }
+
+                for (size_t i = itr->second; i != NIL; i = m_items[i].next)
+                {
+                    auto& item = m_items[i];
+                    const auto d = item.pos - pos;
+                    if (d.x * d.x + d.y * d.y + d.z * d.z < dist_sq &&
+                        visit(item.pos, item.val)) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+template <typename T>
+void SpatialHash<T>::Clear()
+{
+    m_items.clear();
+    m_cells.clear();
+}
+
+template <typename T>
+void SpatialHash<T>::CalcCell(const sm::vec3& pos, int cell[3]) const
+{
+    // clamped before the cast, which overflows for far or nan coords,
+    // the far cells share the border ones and Query filters them by distance
+    const float limit = static_cast<float>(1 << 20);
+    auto to_cell = [&](float v) -> int {
+        const float f = floorf(v / m_cell_size);
+        if (!(f > -limit)) {
+            return -(1 << 20);
+        } else if (f > limit) {
+            return 1 << 20;
+        } else {
+            return static_cast<int>(f);
+        }
+    };
+    cell[0] = to_cell(pos.x);
+    cell[1] = to_cell(pos.y);
+    cell[2] = to_cell(pos.z);
+}
+
+template <typename T>
+uint64_t SpatialHash<T>::CellKey(int x, int y, int z)
+{
+    // 21 bits per axis, far cells may share a key, Query filters them by distance
+    const uint64_t mask = (1ull << 21) - 1;
+    return (static_cast<uint64_t>(x) & mask)
+        | ((static_cast<uint64_t>(y) & mask) << 21)
+        | ((static_cast<uint64_t>(z) & mask) << 42);
+}
+
+}
\ No newline at end of file
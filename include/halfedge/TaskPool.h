@@ -0,0 +1,82 @@
+#pragma once
+
+#include "halfedge/noncopyable.h"
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace he
+{
+
+// Work-stealing thread pool.
+// Each worker pops its own queue from the back and steals the others' from
+// the front, tasks may spawn tasks, and Wait runs tasks until its group is done.
+class TaskPool : noncopyable
+{
+public:
+    // tasks waited together
+    class Group : noncopyable
+    {
+    public:
+        Group() {}
+
+    private:
+        std::atomic<size_t> m_pending{ 0 };
+
+        friend class TaskPool;
+
+    }; // Group
+
+public:
+    TaskPool(size_t thread_num);
+    ~TaskPool();
+
+    void Run(Group& group, std::function<void()> task);
+    void Wait(Group& group);
+
+    size_t GetThreadNum() const { return m_threads.size(); }
+
+    // shared by the library, one worker less than the hardware threads,
+    // the waiting thread takes its place
+    static TaskPool& Instance();
+
+private:
+    struct Task
+    {
+        std::function<void()> func;
+        Group* group = nullptr;
+    };
+
+    struct Queue
+    {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+    };
+
+    size_t QueryQueue() const;
+
+    bool Pop(size_t queue, Task& task);
+
+    void WorkerLoop(size_t queue);
+
+private:
+    std::vector<std::thread> m_threads;
+
+    // one for each worker, the last for the other threads
+    std::vector<std::unique_ptr<Queue>> m_queues;
+
+    std::atomic<size_t> m_pending{ 0 };
+
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    bool m_stop = false;
+
+}; // TaskPool
+
+}
\ No newline at end of file
@@ -27,7 +27,7 @@ public:
 
     auto& Path() const { return m_path; }
 
-    void MakeInvalid() { m_path = { 0xffffffff }; }
+    void MakeInvalid() { m_path = { 0xffffffff }; UpdateUID(); }
     bool IsValid() const {
         return !(m_path.size() == 1 && m_path[0] == 0xffffffff);
     }
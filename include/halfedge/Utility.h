@@ -3,6 +3,7 @@
 #include "halfedge/DoublyLinkedList.h"
 #include "halfedge/HalfEdge.h"
 #include "halfedge/Polyhedron.h"
+#include "halfedge/Polygon.h"
 
 #include <SM_Plane.h>
 
@@ -29,27 +30,63 @@ public:
     template<typename T>
     static size_t EdgeSize(const Loop<T>& loop);
 
+    // func(i) for i in [0, num) on the shared TaskPool, items are pulled
+    // from a shared cursor, so func must only write to its own item
+    template<typename Func>
+    static void ParallelFor(size_t num, Func func);
+    // as ParallelFor, func(i) is called for each item, but the items are
+    // pulled in blocks, for light funcs over many items
+    template<typename Func>
+    static void ParallelForBlocks(size_t num, Func func, size_t block_size = 1024);
+
     // 2d
 
     static bool IsLoopConvex(const loop2& loop);
     static bool IsLoopClockwise(const loop2& loop);
 
+    // triangulate the border with the holes, the triangles are appended as index triples
+    // into the verts of the border then the holes, each from its loop's edge,
+    // a fan for a convex border without holes, else the holes are bridged to the
+    // border and the ears clipped, all the loop edges are kept, flat triangles included,
+    // nothing is appended if a hole can't be bridged
+    static void TriangulateFace(const Polygon::Face& face, std::vector<size_t>& tris);
+
     // 3d
 
     static void LoopToVertices(const loop3& loop, std::vector<sm::vec3>& border);
     static void LoopToPlane(const loop3& loop, sm::Plane& plane);
 
+    // the points inside the plane go to both sides,
+    // a side with less than 3 points is left empty
+    static void SplitPolygon(const std::vector<sm::vec3>& polygon, const sm::Plane& plane,
+        std::vector<sm::vec3>& above, std::vector<sm::vec3>& below);
+
     static sm::vec3 CalcLoopNorm(const loop3& loop);
     static sm::vec3 CalcFaceNorm(const Polyhedron::Face& face);
 
+    // as the 2d one, in the border's plane by LoopToPlane
+    static void TriangulateFace(const Polyhedron::Face& face, std::vector<size_t>& tris);
+
+    // each iteration moves every point toward the average of its ring by each factor in turn,
+    // the rings are in csr, ring_begin has point num + 1 entries, points with empty rings stay,
+    // each pass reads one buffer and writes the other, in parallel blocks
+    static void SmoothPoints(std::vector<sm::vec3>& pts, const std::vector<size_t>& ring_begin,
+        const std::vector<size_t>& rings, const std::vector<float>& factors, size_t iterations);
+
     static constexpr float POINT_STATUS_EPSILON = 0.0001f;
 
+    // signed distance, products and sums in double
+    static double CalcPointPlaneDistance(const sm::Plane& plane, const sm::vec3& pos);
+
     enum class PointStatus
     {
         Above,
         Below,
         Inside,
     };
+    // exact classification against the band [-POINT_STATUS_EPSILON, POINT_STATUS_EPSILON],
+    // a certified double filter decides most points, ambiguous ones fall back to
+    // exact expansion arithmetic, so the same point always gets the same status
     static PointStatus CalcPointPlaneStatus(const sm::Plane& plane, const sm::vec3& pos);
 
     enum class FaceStatus
@@ -60,6 +97,16 @@ public:
         Cross,
     };
     static FaceStatus CalcFacePlaneStatus(const Polyhedron::Face& face, const sm::Plane& plane);
+    // by the verts, stop at the first pair across the plane
+    static FaceStatus CalcPolyhedronPlaneStatus(const Polyhedron& poly, const sm::Plane& plane);
+
+    // by the corners: Above or Below when no corner is on the other side,
+    // Inside when the box crosses the plane, lies in it or is empty
+    static PointStatus CalcAABBPlaneStatus(const sm::cube& aabb, const sm::Plane& plane);
+    // overlap with volume, touching or empty boxes don't
+    static bool IsAABBOverlap(const sm::cube& a, const sm::cube& b);
+    // on a side of the box or out of it, exact compares
+    static bool IsPointOnAABB(const sm::cube& aabb, const sm::vec3& pos);
 
 }; // Utility
 
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "halfedge/TaskPool.h"
+
 #include <set>
+#include <atomic>
+#include <algorithm>
 
 namespace he
 {
@@ -127,4 +131,49 @@ size_t Utility::EdgeSize(const Loop<T>& loop)
     return num;
 }
 
+template<typename Func>
+void Utility::ParallelFor(size_t num, Func func)
+{
+    auto& pool = TaskPool::Instance();
+
+    const size_t task_num = std::min(pool.GetThreadNum() + 1, num);
+    if (task_num <= 1)
+    {
+        for (size_t i = 0; i < num; ++i) {
+            func(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> cursor(0);
+    auto worker = [&]()
+    {
+        for (size_t i = cursor++; i < num; i = cursor++) {
+            func(i);
+        }
+    };
+
+    TaskPool::Group group;
+    for (size_t i = 1; i < task_num; ++i) {
+        pool.Run(group, worker);
+    }
+    worker();
+    pool.Wait(group);
+}
+
+template<typename Func>
+void Utility::ParallelForBlocks(size_t num, Func func, size_t block_size)
+{
+    assert(block_size > 0);
+
+    const size_t blocks = (num + block_size - 1) / block_size;
+    ParallelFor(blocks, [&](size_t b)
+    {
+        const size_t end = std::min(num, (b + 1) * block_size);
+        for (size_t i = b * block_size; i < end; ++i) {
+            func(i);
+        }
+    });
+}
+
 }
\ No newline at end of file
@@ -11,4 +11,7 @@ using PolyhedronPtr = std::shared_ptr<Polyhedron>;
 class Polyline;
 using PolylinePtr = std::shared_ptr<Polyline>;
 
+class CSGNode;
+using CSGNodePtr = std::shared_ptr<CSGNode>;
+
 }
\ No newline at end of file
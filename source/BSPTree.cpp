@@ -0,0 +1,372 @@
+#include "halfedge/BSPTree.h"
+#include "halfedge/Polyhedron.h"
+#include "halfedge/Utility.h"
+#include "halfedge/TaskPool.h"
+#include "halfedge/CancelToken.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+
+using PointStatus = he::Utility::PointStatus;
+using FaceStatus  = he::Utility::FaceStatus;
+
+// the candidates tested for each splitter
+const size_t SPLITTER_SAMPLES = 8;
+
+// the cells split in a batch for each thread, before the pieces are passed on
+const size_t CELLS_PER_THREAD = 4;
+
+template <typename Face>
+FaceStatus calc_face_status(const Face& face, const sm::Plane& plane)
+{
+    bool above = false, below = false;
+    for (auto& p : face.border)
+    {
+        switch (he::Utility::CalcPointPlaneStatus(plane, p))
+        {
+        case PointStatus::Above:
+            above = true;
+            break;
+        case PointStatus::Below:
+            below = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (above && below) {
+        return FaceStatus::Cross;
+    } else if (above) {
+        return FaceStatus::Above;
+    } else if (below) {
+        return FaceStatus::Below;
+    } else {
+        return FaceStatus::Inside;
+    }
+}
+
+template <typename Face>
+void split_face(const Face& face, const sm::Plane& plane, std::vector<Face>& above, std::vector<Face>& below)
+{
+    Face a, b;
+    a.plane = b.plane = face.plane;
+    he::Utility::SplitPolygon(face.border, plane, a.border, b.border);
+    if (!a.border.empty()) {
+        above.push_back(a);
+    }
+    if (!b.border.empty()) {
+        below.push_back(b);
+    }
+}
+
+// right-hand, loops are ccw seen from outside
+he::PolyhedronPtr build_box(const sm::cube& aabb)
+{
+    std::vector<he::Polyhedron::in_vert> verts;
+    verts.reserve(8);
+    for (int i = 0; i < 8; ++i)
+    {
+        sm::vec3 pos(
+            i & 1 ? aabb.max[0] : aabb.min[0],
+            i & 2 ? aabb.max[1] : aabb.min[1],
+            i & 4 ? aabb.max[2] : aabb.min[2]
+        );
+        verts.push_back({ he::TopoID(), pos });
+    }
+
+    const std::vector<he::Polyhedron::in_loop> loops = {
+        { 0, 2, 3, 1 }, { 4, 5, 7, 6 },
+        { 0, 1, 5, 4 }, { 2, 6, 7, 3 },
+        { 0, 4, 6, 2 }, { 1, 3, 7, 5 },
+    };
+    std::vector<he::Polyhedron::in_face> faces;
+    faces.reserve(loops.size());
+    for (auto& loop : loops) {
+        faces.push_back({ he::TopoID(), loop, {} });
+    }
+
+    return std::make_shared<he::Polyhedron>(verts, faces);
+}
+
+}
+
+namespace he
+{
+
+BSPTree::BSPTree(const Polyhedron& solid)
+{
+    std::vector<Face> faces;
+    faces.reserve(solid.GetFaces().size());
+    std::vector<sm::vec3> pts;
+    std::vector<size_t> tris;
+    for (auto& src : solid.GetFaces())
+    {
+        assert(src.border);
+
+        Face dst;
+        Utility::LoopToVertices(*src.border, dst.border);
+        if (dst.border.size() <= 2) {
+            continue;
+        }
+        Utility::LoopToPlane(*src.border, dst.plane);
+
+        // a face with holes goes in as its triangles, the pieces only need to
+        // cover it, the border alone if a hole is not inside it
+        tris.clear();
+        if (!src.holes.empty()) {
+            Utility::TriangulateFace(src, tris);
+        }
+        if (tris.empty())
+        {
+            faces.push_back(dst);
+            continue;
+        }
+
+        pts = dst.border;
+        for (auto& hole : src.holes) {
+            Utility::LoopToVertices(*hole, pts);
+        }
+        for (size_t i = 0, n = tris.size(); i < n; i += 3)
+        {
+            Face tri;
+            tri.plane = dst.plane;
+            tri.border = { pts[tris[i]], pts[tris[i + 1]], pts[tris[i + 2]] };
+            faces.push_back(tri);
+        }
+    }
+
+    if (faces.empty()) {
+        return;
+    }
+
+    m_root = Build(faces);
+
+    Split(*build_box(solid.GetAABB()), &m_cells, nullptr);
+}
+
+void BSPTree::Split(const Polyhedron& convex, std::vector<PolyhedronPtr>* inside,
+                    std::vector<PolyhedronPtr>* outside) const
+{
+    if (convex.GetVerts().Size() == 0) {
+        return;
+    }
+
+    std::vector<std::pair<PolyhedronPtr, int>> buf;
+    buf.push_back({ std::make_shared<Polyhedron>(convex), m_root });
+    while (!buf.empty())
+    {
+        auto poly = buf.back().first;
+        auto node = buf.back().second;
+        buf.pop_back();
+
+        if (node == LEAF_IN)
+        {
+            if (inside) {
+                inside->push_back(poly);
+            }
+            continue;
+        }
+        if (node == LEAF_OUT)
+        {
+            if (outside) {
+                outside->push_back(poly);
+            }
+            continue;
+        }
+
+        // front first
+        auto& n = m_nodes[node];
+        switch (Utility::CalcPolyhedronPlaneStatus(*poly, n.plane))
+        {
+        case FaceStatus::Above:
+            buf.push_back({ poly, n.front });
+            break;
+        case FaceStatus::Below:
+            buf.push_back({ poly, n.back });
+            break;
+        case FaceStatus::Cross:
+            if (auto below = poly->Fork(n.plane)) {
+                buf.push_back({ below, n.back });
+            }
+            buf.push_back({ poly, n.front });
+            break;
+        default:
+            // flat
+            break;
+        }
+    }
+}
+
+std::vector<PolyhedronPtr> BSPTree::Union(const BSPTree& a, const BSPTree& b)
+{
+    std::vector<PolyhedronPtr> ret;
+    Union(a, b, [&ret](const PolyhedronPtr& frag) {
+        ret.push_back(frag);
+    });
+    return ret;
+}
+
+std::vector<PolyhedronPtr> BSPTree::Intersect(const BSPTree& a, const BSPTree& b)
+{
+    std::vector<PolyhedronPtr> ret;
+    Intersect(a, b, [&ret](const PolyhedronPtr& frag) {
+        ret.push_back(frag);
+    });
+    return ret;
+}
+
+std::vector<PolyhedronPtr> BSPTree::Subtract(const BSPTree& a, const BSPTree& b)
+{
+    std::vector<PolyhedronPtr> ret;
+    Subtract(a, b, [&ret](const PolyhedronPtr& frag) {
+        ret.push_back(frag);
+    });
+    return ret;
+}
+
+void BSPTree::Union(const BSPTree& a, const BSPTree& b, const Polyhedron::FragmentSink& sink,
+                    CancelToken* cancel)
+{
+    if (cancel && cancel->IsCancelled()) {
+        return;
+    }
+
+    for (auto& cell : a.m_cells) {
+        sink(std::make_shared<Polyhedron>(*cell));
+    }
+    SplitCells(b.m_cells, a, false, sink, cancel);
+}
+
+void BSPTree::Intersect(const BSPTree& a, const BSPTree& b, const Polyhedron::FragmentSink& sink,
+                        CancelToken* cancel)
+{
+    SplitCells(a.m_cells, b, true, sink, cancel);
+}
+
+void BSPTree::Subtract(const BSPTree& a, const BSPTree& b, const Polyhedron::FragmentSink& sink,
+                       CancelToken* cancel)
+{
+    SplitCells(a.m_cells, b, false, sink, cancel);
+}
+
+void BSPTree::SplitCells(const std::vector<PolyhedronPtr>& cells, const BSPTree& tree,
+                         bool inside, const Polyhedron::FragmentSink& sink, CancelToken* cancel)
+{
+    auto& pool = TaskPool::Instance();
+
+    // a task for each cell, the pieces are kept by cell and
+    // passed on after each batch, a few cells for each thread
+    const size_t batch = (pool.GetThreadNum() + 1) * CELLS_PER_THREAD;
+    for (size_t begin = 0, n = cells.size(); begin < n; begin += batch)
+    {
+        const size_t end = std::min(n, begin + batch);
+        std::vector<std::vector<PolyhedronPtr>> pieces(end - begin);
+
+        TaskPool::Group group;
+        for (size_t i = begin; i < end; ++i)
+        {
+            auto& cell = *cells[i];
+            auto& dst = pieces[i - begin];
+            pool.Run(group, [&tree, &cell, &dst, inside, cancel]()
+            {
+                if (cancel && cancel->IsCancelled()) {
+                    return;
+                }
+                tree.Split(cell, inside ? &dst : nullptr, inside ? nullptr : &dst);
+                if (cancel) {
+                    cancel->Check();
+                }
+            });
+        }
+        pool.Wait(group);
+
+        if (cancel && cancel->IsCancelled()) {
+            return;
+        }
+
+        for (auto& p : pieces) {
+            for (auto& poly : p) {
+                sink(poly);
+            }
+        }
+    }
+}
+
+int BSPTree::Build(const std::vector<Face>& faces)
+{
+    assert(!faces.empty());
+
+    // fewest splits, then the most balanced
+    size_t splitter = 0;
+    size_t best = static_cast<size_t>(-1);
+    const size_t step = std::max<size_t>(1, faces.size() / SPLITTER_SAMPLES);
+    for (size_t i = 0; i < faces.size(); i += step)
+    {
+        size_t above = 0, below = 0, cross = 0;
+        for (auto& f : faces)
+        {
+            switch (calc_face_status(f, faces[i].plane))
+            {
+            case FaceStatus::Above:
+                ++above;
+                break;
+            case FaceStatus::Below:
+                ++below;
+                break;
+            case FaceStatus::Cross:
+                ++cross;
+                break;
+            default:
+                break;
+            }
+        }
+
+        const size_t score = cross * SPLITTER_SAMPLES + (above > below ? above - below : below - above);
+        if (score < best) {
+            best = score;
+            splitter = i;
+        }
+    }
+
+    auto& plane = faces[splitter].plane;
+
+    std::vector<Face> above, below;
+    for (auto& f : faces)
+    {
+        switch (calc_face_status(f, plane))
+        {
+        case FaceStatus::Above:
+            above.push_back(f);
+            break;
+        case FaceStatus::Below:
+            below.push_back(f);
+            break;
+        case FaceStatus::Cross:
+            split_face(f, plane, above, below);
+            break;
+        case FaceStatus::Inside:
+            // same facing are bounded by this node, opposite bound the front space
+            if (f.plane.normal.Dot(plane.normal) < 0) {
+                above.push_back(f);
+            }
+            break;
+        }
+    }
+
+    const int idx = static_cast<int>(m_nodes.size());
+    m_nodes.push_back({ plane, LEAF_OUT, LEAF_IN });
+
+    const int front = above.empty() ? LEAF_OUT : Build(above);
+    const int back  = below.empty() ? LEAF_IN : Build(below);
+    m_nodes[idx].front = front;
+    m_nodes[idx].back  = back;
+
+    return idx;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "halfedge/BooleanCache.h"
+
+#include <functional>
+#include <cstring>
+
+namespace
+{
+
+template <class T>
+inline void hash_combine(std::size_t& seed, const T& v)
+{
+    std::hash<T> hasher;
+    seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+}
+
+namespace he
+{
+
+BooleanCache::BooleanCache(size_t capacity)
+    : m_capacity(capacity)
+{
+}
+
+std::vector<PolyhedronPtr> BooleanCache::Union(const Polyhedron& a, const Polyhedron& b, bool merge)
+{
+    auto key = MakeKey(Op::Union, a, &b, merge ? 1 : 0);
+
+    bool succ;
+    std::vector<PolyhedronPtr> ret;
+    if (Query(key, a, &b, succ, ret)) {
+        return ret;
+    }
+
+    ret = a.Union(b, merge);
+    Insert(key, a, &b, true, ret);
+    return ret;
+}
+
+PolyhedronPtr BooleanCache::Intersect(const Polyhedron& a, const Polyhedron& b)
+{
+    auto key = MakeKey(Op::Intersect, a, &b, 0);
+
+    bool succ;
+    std::vector<PolyhedronPtr> polys;
+    if (Query(key, a, &b, succ, polys)) {
+        return succ ? polys.front() : nullptr;
+    }
+
+    auto ret = a.Intersect(b);
+    if (ret) {
+        Insert(key, a, &b, true, { ret });
+    } else {
+        Insert(key, a, &b, false, {});
+    }
+    return ret;
+}
+
+std::vector<PolyhedronPtr> BooleanCache::Subtract(const Polyhedron& a, const Polyhedron& b, bool merge)
+{
+    auto key = MakeKey(Op::Subtract, a, &b, merge ? 1 : 0);
+
+    bool succ;
+    std::vector<PolyhedronPtr> ret;
+    if (Query(key, a, &b, succ, ret)) {
+        return ret;
+    }
+
+    ret = a.Subtract(b, merge);
+    Insert(key, a, &b, true, ret);
+    return ret;
+}
+
+PolyhedronPtr BooleanCache::Clip(const Polyhedron& poly, const sm::Plane& plane, Polyhedron::KeepType keep, bool seam_face)
+{
+    auto key = MakeKey(Op::Clip, poly, nullptr, static_cast<int>(keep) * 2 + (seam_face ? 1 : 0));
+    key.plane[0] = plane.normal.x;
+    key.plane[1] = plane.normal.y;
+    key.plane[2] = plane.normal.z;
+    key.plane[3] = plane.dist;
+
+    bool succ;
+    std::vector<PolyhedronPtr> polys;
+    if (Query(key, poly, nullptr, succ, polys)) {
+        return succ ? polys.front() : nullptr;
+    }
+
+    auto ret = std::make_shared<Polyhedron>(poly);
+    if (ret->Clip(plane, keep, seam_face)) {
+        Insert(key, poly, nullptr, true, { ret });
+    } else {
+        ret.reset();
+        Insert(key, poly, nullptr, false, {});
+    }
+    return ret;
+}
+
+void BooleanCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    m_entries.clear();
+    m_key2entry.clear();
+
+    m_hits = 0;
+    m_misses = 0;
+}
+
+bool BooleanCache::Key::operator == (const Key& key) const
+{
+    return op == key.op
+        && a == key.a && b == key.b
+        && a_verts == key.a_verts && b_verts == key.b_verts
+        && memcmp(plane, key.plane, sizeof(plane)) == 0
+        && flags == key.flags;
+}
+
+size_t BooleanCache::KeyHash::operator () (const Key& key) const
+{
+    size_t seed = 0;
+    hash_combine(seed, static_cast<int>(key.op));
+    hash_combine(seed, key.a);
+    hash_combine(seed, key.b);
+    for (auto& f : key.plane) {
+        hash_combine(seed, f);
+    }
+    hash_combine(seed, key.flags);
+    return seed;
+}
+
+bool BooleanCache::Query(const Key& key, const Polyhedron& a, const Polyhedron* b,
+                         bool& succ, std::vector<PolyhedronPtr>& polys)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+
+        auto itr = m_key2entry.find(key);
+        if (itr == m_key2entry.end() ||
+            !IsSame(*itr->second->a, a) ||
+            (b && !IsSame(*itr->second->b, *b)))
+        {
+            ++m_misses;
+            return false;
+        }
+
+        m_entries.splice(m_entries.begin(), m_entries, itr->second);
+        succ = itr->second->succ;
+        polys = itr->second->polys;
+
+        ++m_hits;
+    }
+
+    // copy out of the lock
+    polys = Copy(polys);
+
+    return true;
+}
+
+void BooleanCache::Insert(const Key& key, const Polyhedron& a, const Polyhedron* b,
+                          bool succ, const std::vector<PolyhedronPtr>& polys)
+{
+    if (m_capacity == 0) {
+        return;
+    }
+
+    auto copied = Copy(polys);
+    auto copied_a = std::make_shared<Polyhedron>(a);
+    auto copied_b = b ? std::make_shared<Polyhedron>(*b) : nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    // inserted by another thread, or a colliding key which is kept
+    if (m_key2entry.find(key) != m_key2entry.end()) {
+        return;
+    }
+
+    m_entries.push_front({ key, copied_a, copied_b, succ, copied });
+    m_key2entry.insert({ key, m_entries.begin() });
+
+    while (m_entries.size() > m_capacity)
+    {
+        m_key2entry.erase(m_entries.back().key);
+        m_entries.pop_back();
+    }
+}
+
+BooleanCache::Key BooleanCache::MakeKey(Op op, const Polyhedron& a, const Polyhedron* b, int flags)
+{
+    Key key;
+    key.op = op;
+    key.a = a.GetHash();
+    key.a_verts = a.GetVerts().Size();
+    key.b = b ? b->GetHash() : 0;
+    key.b_verts = b ? b->GetVerts().Size() : 0;
+    for (auto& f : key.plane) {
+        f = 0;
+    }
+    key.flags = flags;
+    return key;
+}
+
+bool BooleanCache::IsSame(const Polyhedron& a, const Polyhedron& b)
+{
+    if (&a == &b) {
+        return true;
+    }
+
+    auto& a_verts = a.GetVerts();
+    auto& b_verts = b.GetVerts();
+    if (a_verts.Size() != b_verts.Size() ||
+        a.GetEdges().Size() != b.GetEdges().Size() ||
+        a.GetFaces().size() != b.GetFaces().size()) {
+        return false;
+    }
+
+    // verts in list order, loops by vert index, as GetHash()
+    std::unordered_map<const vert3*, size_t> a_vert2idx, b_vert2idx;
+    a_vert2idx.reserve(a_verts.Size());
+    b_vert2idx.reserve(b_verts.Size());
+    if (auto first_a = a_verts.Head())
+    {
+        auto curr_a = first_a;
+        auto curr_b = b_verts.Head();
+        do {
+            if (curr_a->position != curr_b->position) {
+                return false;
+            }
+            a_vert2idx.insert({ curr_a, a_vert2idx.size() });
+            b_vert2idx.insert({ curr_b, b_vert2idx.size() });
+            curr_a = curr_a->linked_next;
+            curr_b = curr_b->linked_next;
+        } while (curr_a != first_a);
+    }
+
+    auto is_same_loop = [&](const loop3& la, const loop3& lb) -> bool
+    {
+        auto first_a = la.edge;
+        auto curr_a = first_a;
+        auto curr_b = lb.edge;
+        do {
+            if (!curr_b || a_vert2idx[curr_a->vert] != b_vert2idx[curr_b->vert]) {
+                return false;
+            }
+            curr_a = curr_a->next;
+            curr_b = curr_b->next;
+        } while (curr_a && curr_a != first_a);
+
+        return curr_b == lb.edge || (!curr_a && !curr_b);
+    };
+
+    auto& a_faces = a.GetFaces();
+    auto& b_faces = b.GetFaces();
+    for (size_t i = 0, n = a_faces.size(); i < n; ++i)
+    {
+        auto& fa = a_faces[i];
+        auto& fb = b_faces[i];
+        if (fa.holes.size() != fb.holes.size() ||
+            !is_same_loop(*fa.border, *fb.border)) {
+            return false;
+        }
+        for (size_t j = 0, m = fa.holes.size(); j < m; ++j) {
+            if (!is_same_loop(*fa.holes[j], *fb.holes[j])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+std::vector<PolyhedronPtr> BooleanCache::Copy(const std::vector<PolyhedronPtr>& polys)
+{
+    std::vector<PolyhedronPtr> ret;
+    ret.reserve(polys.size());
+    for (auto& poly : polys) {
+        ret.push_back(poly ? std::make_shared<Polyhedron>(*poly) : nullptr);
+    }
+    return ret;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,367 @@
+#include "halfedge/CSGNode.h"
+#include "halfedge/Polyhedron.h"
+#include "halfedge/Utility.h"
+
+#include <assert.h>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <iterator>
+
+namespace
+{
+
+using Frags = std::vector<he::PolyhedronPtr>;
+using Type  = he::CSGNode::Type;
+
+float CalcAABBVolume(const sm::cube& aabb)
+{
+    if (!aabb.IsValid()) {
+        return 0;
+    }
+    return (aabb.max[0] - aabb.min[0]) * (aabb.max[1] - aabb.min[1]) * (aabb.max[2] - aabb.min[2]);
+}
+
+sm::cube CalcAABBOverlap(const sm::cube& a, const sm::cube& b)
+{
+    sm::cube ret;
+    if (!he::Utility::IsAABBOverlap(a, b)) {
+        return ret;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        ret.min[i] = std::max(a.min[i], b.min[i]);
+        ret.max[i] = std::min(a.max[i], b.max[i]);
+    }
+    return ret;
+}
+
+// the leaves' boxes are read now, the polys may be edited after the tree is built
+const sm::cube& CalcAABB(const he::CSGNode& node, std::map<const he::CSGNode*, sm::cube>& cache)
+{
+    auto itr = cache.find(&node);
+    if (itr != cache.end()) {
+        return itr->second;
+    }
+
+    sm::cube aabb;
+    auto& children = node.GetChildren();
+    switch (node.GetType())
+    {
+    case Type::Leaf:
+        if (node.GetPoly()) {
+            aabb = node.GetPoly()->GetAABB();
+        }
+        break;
+    case Type::Union:
+    {
+        aabb = CalcAABB(*children[0], cache);
+        auto& b = CalcAABB(*children[1], cache);
+        if (b.IsValid()) {
+            aabb.Combine(b);
+        }
+    }
+        break;
+    case Type::Intersect:
+        aabb = CalcAABBOverlap(CalcAABB(*children[0], cache), CalcAABB(*children[1], cache));
+        break;
+    case Type::Subtract:
+        aabb = CalcAABB(*children[0], cache);
+        break;
+    }
+
+    return cache.insert({ &node, aabb }).first->second;
+}
+
+class Evaluator
+{
+public:
+    Evaluator(const he::CSGNode& root)
+    {
+        CountParents(root);
+    }
+
+    Frags Eval(const he::CSGNode& node)
+    {
+        auto itr = m_cache.find(&node);
+        if (itr != m_cache.end()) {
+            return itr->second;
+        }
+
+        Frags ret;
+        switch (node.GetType())
+        {
+        case Type::Leaf:
+            if (node.GetPoly()) {
+                ret.push_back(node.GetPoly());
+            }
+            break;
+        case Type::Union:
+            ret = EvalUnion(node);
+            break;
+        case Type::Intersect:
+            ret = EvalIntersect(node);
+            break;
+        case Type::Subtract:
+            ret = EvalSubtract(node);
+            break;
+        }
+
+        // only the shared ones are looked up again
+        if (m_parents[&node] > 1) {
+            m_cache.insert({ &node, ret });
+        }
+
+        return ret;
+    }
+
+private:
+    const sm::cube& GetAABB(const he::CSGNode& node) {
+        return CalcAABB(node, m_aabbs);
+    }
+
+    void CountParents(const he::CSGNode& node)
+    {
+        if (m_parents[&node]++ > 0) {
+            return;
+        }
+        for (auto& child : node.GetChildren()) {
+            CountParents(*child);
+        }
+    }
+
+    // the children of the same op and not shared are merged into the parent,
+    // subtract takes (a - b) - c on the left and b U c on the right
+    void Flatten(const he::CSGNode& node, std::vector<const he::CSGNode*>& operands) const
+    {
+        auto& children = node.GetChildren();
+        for (size_t i = 0, n = children.size(); i < n; ++i)
+        {
+            auto child = children[i].get();
+            bool flat = child->GetType() == node.GetType();
+            if (node.GetType() == Type::Subtract) {
+                flat = i == 0 ? flat : child->GetType() == Type::Union;
+            }
+            if (flat && m_parents.find(child)->second == 1) {
+                Flatten(*child, operands);
+            } else {
+                operands.push_back(child);
+            }
+        }
+    }
+
+    // a U b U ... = a + (b - a) + ..., the larger first keep whole
+    Frags EvalUnion(const he::CSGNode& node)
+    {
+        std::vector<const he::CSGNode*> operands;
+        Flatten(node, operands);
+        std::stable_sort(operands.begin(), operands.end(),
+            [&](const he::CSGNode* a, const he::CSGNode* b) {
+                return CalcAABBVolume(GetAABB(*a)) > CalcAABBVolume(GetAABB(*b));
+            });
+
+        Frags ret;
+        for (auto& op : operands)
+        {
+            auto frags = Eval(*op);
+            if (ret.empty()) {
+                ret = frags;
+                continue;
+            }
+
+            auto pieces = SubtractFrags(frags, ret);
+            std::copy(pieces.begin(), pieces.end(), std::back_inserter(ret));
+        }
+        return ret;
+    }
+
+    // the smallest first, stop when nothing is left,
+    // the others are not evaluated
+    Frags EvalIntersect(const he::CSGNode& node)
+    {
+        if (!GetAABB(node).IsValid()) {
+            return {};
+        }
+
+        std::vector<const he::CSGNode*> operands;
+        Flatten(node, operands);
+        std::stable_sort(operands.begin(), operands.end(),
+            [&](const he::CSGNode* a, const he::CSGNode* b) {
+                return CalcAABBVolume(GetAABB(*a)) < CalcAABBVolume(GetAABB(*b));
+            });
+
+        Frags ret;
+        for (size_t i = 0, n = operands.size(); i < n; ++i)
+        {
+            if (i == 0)
+            {
+                ret = Eval(*operands[i]);
+                continue;
+            }
+            if (ret.empty()) {
+                break;
+            }
+
+            auto others = Eval(*operands[i]);
+
+            std::vector<Frags> pieces(ret.size());
+            he::Utility::ParallelFor(ret.size(), [&](size_t j)
+            {
+                for (auto& other : others)
+                {
+                    if (!he::Utility::IsAABBOverlap(ret[j]->GetAABB(), other->GetAABB())) {
+                        continue;
+                    }
+                    auto poly = ret[j]->Intersect(*other);
+                    if (poly && !poly->GetFaces().empty()) {
+                        pieces[j].push_back(poly);
+                    }
+                }
+            });
+
+            ret.clear();
+            for (auto& p : pieces) {
+                std::copy(p.begin(), p.end(), std::back_inserter(ret));
+            }
+        }
+        return ret;
+    }
+
+    // a - b - c = a - (b + c), the cutters off the minuend's box are not evaluated
+    Frags EvalSubtract(const he::CSGNode& node)
+    {
+        std::vector<const he::CSGNode*> operands;
+        Flatten(node, operands);
+        assert(!operands.empty());
+
+        auto ret = Eval(*operands.front());
+        if (ret.empty()) {
+            return ret;
+        }
+
+        Frags cutters;
+        for (size_t i = 1, n = operands.size(); i < n; ++i)
+        {
+            if (!he::Utility::IsAABBOverlap(GetAABB(*operands[i]), GetAABB(node))) {
+                continue;
+            }
+            auto frags = Eval(*operands[i]);
+            std::copy(frags.begin(), frags.end(), std::back_inserter(cutters));
+        }
+
+        return SubtractFrags(ret, cutters);
+    }
+
+    static Frags SubtractFrags(const Frags& frags, const Frags& cutters)
+    {
+        if (cutters.empty()) {
+            return frags;
+        }
+
+        std::vector<Frags> pieces(frags.size());
+        he::Utility::ParallelFor(frags.size(), [&](size_t i)
+        {
+            // keep the frag itself when no cutter reaches it
+            bool overlap = false;
+            for (auto& cutter : cutters) {
+                if (he::Utility::IsAABBOverlap(frags[i]->GetAABB(), cutter->GetAABB())) {
+                    overlap = true;
+                    break;
+                }
+            }
+            if (overlap) {
+                pieces[i] = frags[i]->Subtract(cutters);
+            } else {
+                pieces[i].push_back(frags[i]);
+            }
+        });
+
+        Frags ret;
+        for (auto& p : pieces) {
+            std::copy(p.begin(), p.end(), std::back_inserter(ret));
+        }
+        return ret;
+    }
+
+private:
+    std::map<const he::CSGNode*, size_t> m_parents;
+
+    std::map<const he::CSGNode*, Frags> m_cache;
+
+    std::map<const he::CSGNode*, sm::cube> m_aabbs;
+
+}; // Evaluator
+
+}
+
+namespace he
+{
+
+CSGNode::CSGNode(Type type)
+    : m_type(type)
+{
+}
+
+CSGNodePtr CSGNode::Leaf(const PolyhedronPtr& poly)
+{
+    CSGNodePtr ret(new CSGNode(Type::Leaf));
+    ret->m_poly = poly;
+    return ret;
+}
+
+CSGNodePtr CSGNode::Union(const CSGNodePtr& a, const CSGNodePtr& b)
+{
+    CSGNodePtr ret(new CSGNode(Type::Union));
+    ret->m_children = { a, b };
+    return ret;
+}
+
+CSGNodePtr CSGNode::Intersect(const CSGNodePtr& a, const CSGNodePtr& b)
+{
+    CSGNodePtr ret(new CSGNode(Type::Intersect));
+    ret->m_children = { a, b };
+    return ret;
+}
+
+CSGNodePtr CSGNode::Subtract(const CSGNodePtr& a, const CSGNodePtr& b)
+{
+    CSGNodePtr ret(new CSGNode(Type::Subtract));
+    ret->m_children = { a, b };
+    return ret;
+}
+
+sm::cube CSGNode::GetAABB() const
+{
+    std::map<const CSGNode*, sm::cube> cache;
+    return CalcAABB(*this, cache);
+}
+
+std::vector<PolyhedronPtr> CSGNode::Evaluate(bool merge) const
+{
+    Evaluator evaluator(*this);
+    auto ret = evaluator.Eval(*this);
+
+    // the leaves' polys are shared until now
+    std::set<const Polyhedron*> leaves;
+    std::vector<const CSGNode*> buf = { this };
+    while (!buf.empty())
+    {
+        auto node = buf.back();
+        buf.pop_back();
+        if (node->m_poly) {
+            leaves.insert(node->m_poly.get());
+        }
+        for (auto& child : node->m_children) {
+            buf.push_back(child.get());
+        }
+    }
+    for (auto& poly : ret) {
+        if (leaves.find(poly.get()) != leaves.end()) {
+            poly = std::make_shared<Polyhedron>(*poly);
+        }
+    }
+
+    return merge ? Polyhedron::MergeFragments(ret) : ret;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "halfedge/EditLog.h"
+
+namespace he
+{
+
+EditLog::EditLog(Polyhedron& poly)
+    : m_poly(poly)
+    , m_verts(poly.m_verts)
+    , m_edges(poly.m_edges)
+    , m_loops(poly.m_loops)
+    , m_aabb(poly.GetAABB())
+    , m_next_vert_id(poly.m_next_vert_id)
+    , m_next_edge_id(poly.m_next_edge_id)
+    , m_next_loop_id(poly.m_next_loop_id)
+{
+}
+
+EditLog::~EditLog()
+{
+    Commit();
+}
+
+void EditLog::AppendFace()
+{
+    m_face_ops.push_back({ false, 0, Polyhedron::Face() });
+}
+
+void EditLog::EraseFace(size_t idx, const Polyhedron::Face& face)
+{
+    m_face_ops.push_back({ true, idx, face });
+}
+
+void EditLog::Commit()
+{
+    if (m_finished) {
+        return;
+    }
+
+    Commit(m_verts);
+    Commit(m_edges);
+    Commit(m_loops);
+
+    m_face_ops.clear();
+
+    m_finished = true;
+}
+
+void EditLog::Rollback()
+{
+    if (m_finished) {
+        return;
+    }
+
+    auto& faces = m_poly.m_faces;
+    for (auto itr = m_face_ops.rbegin(); itr != m_face_ops.rend(); ++itr)
+    {
+        if (itr->erase) {
+            assert(itr->idx <= faces.size());
+            faces.insert(faces.begin() + itr->idx, itr->face);
+        } else {
+            assert(!faces.empty());
+            faces.pop_back();
+        }
+    }
+    m_face_ops.clear();
+
+    Rollback(m_verts);
+    Rollback(m_edges);
+    Rollback(m_loops);
+
+    m_poly.m_aabb = m_aabb;
+    m_poly.m_aabb_dirty = false;
+    m_poly.m_hash = 0;
+
+    m_poly.m_next_vert_id = m_next_vert_id;
+    m_poly.m_next_edge_id = m_next_edge_id;
+    m_poly.m_next_loop_id = m_next_loop_id;
+
+    m_finished = true;
+}
+
+template<typename T>
+void EditLog::Commit(Record<T>& rec)
+{
+    for (auto& item : rec.deleted) {
+        delete item;
+    }
+
+    rec.old.clear();
+    rec.added.clear();
+    rec.deleted.clear();
+}
+
+template<typename T>
+void EditLog::Rollback(Record<T>& rec)
+{
+    // links of the removed items and their neighbors come back with the snapshots
+    for (auto& itr : rec.old) {
+        *itr.first = itr.second;
+    }
+    rec.list.Reset(rec.head, rec.size);
+
+    for (auto& item : rec.added) {
+        delete item;
+    }
+
+    rec.old.clear();
+    rec.added.clear();
+    rec.deleted.clear();
+}
+
+}
\ No newline at end of file
@@ -8,10 +8,6 @@
 namespace he
 {
 
-size_t Polygon::m_next_vert_id = 0;
-size_t Polygon::m_next_edge_id = 0;
-size_t Polygon::m_next_loop_id = 0;
-
 Polygon::Polygon(const Polygon& poly)
 {
     this->operator = (poly);
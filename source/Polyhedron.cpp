@@ -1,15 +1,27 @@
 #include "halfedge/Polyhedron.h"
+#include "halfedge/EditLog.h"
+#include "halfedge/Utility.h"
 
 #include <SM_Vector.h>
 
 #include <map>
+#include <unordered_map>
+#include <functional>
 
-namespace he
+namespace
+{
+
+template <class T>
+inline void hash_combine(std::size_t& seed, const T& v)
 {
+    std::hash<T> hasher;
+    seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
 
-size_t Polyhedron::m_next_vert_id = 0;
-size_t Polyhedron::m_next_edge_id = 0;
-size_t Polyhedron::m_next_loop_id = 0;
+}
+
+namespace he
+{
 
 Polyhedron::Polyhedron(const Polyhedron& poly)
 {
@@ -31,6 +43,11 @@ Polyhedron::Polyhedron(const std::vector<Face>& faces)
     BuildFromFaces(faces);
 }
 
+Polyhedron::~Polyhedron()
+{
+    Commit();
+}
+
 Polyhedron& Polyhedron::operator = (const Polyhedron& poly)
 {
     std::map<vert3*, size_t> vert2idx;
@@ -60,17 +77,109 @@ Polyhedron& Polyhedron::operator = (const Polyhedron& poly)
     return *this;
 }
 
+const sm::cube& Polyhedron::GetAABB() const
+{
+    // double checked, a poly may be queried from many tasks
+    if (m_aabb_dirty)
+    {
+        std::lock_guard<std::mutex> lock(m_aabb_mtx);
+        if (m_aabb_dirty)
+        {
+            m_aabb.MakeEmpty();
+
+            auto head = m_verts.Head();
+            if (head) {
+                auto v = head;
+                do {
+                    m_aabb.Combine(v->position);
+                    v = v->linked_next;
+                } while (v != head);
+            }
+
+            m_aabb_dirty = false;
+        }
+    }
+    return m_aabb;
+}
+
 void Polyhedron::UpdateAABB()
 {
-	m_aabb.MakeEmpty();
+    m_hash = 0;
+
+    m_aabb_dirty = true;
+    GetAABB();
+}
+
+size_t Polyhedron::GetHash() const
+{
+    if (m_hash != 0) {
+        return m_hash;
+    }
 
-    auto head = m_verts.Head();
-    if (head) {
-        auto v = head;
+    size_t seed = 0;
+
+    std::unordered_map<const vert3*, size_t> vert2idx;
+    vert2idx.reserve(m_verts.Size());
+    if (auto first_v = m_verts.Head())
+    {
+        auto curr_v = first_v;
         do {
-            m_aabb.Combine(v->position);
-            v = v->linked_next;
-        } while (v != head);
+            vert2idx.insert({ curr_v, vert2idx.size() });
+            hash_combine(seed, curr_v->position.x);
+            hash_combine(seed, curr_v->position.y);
+            hash_combine(seed, curr_v->position.z);
+            curr_v = curr_v->linked_next;
+        } while (curr_v != first_v);
+    }
+
+    auto hash_loop = [&](const loop3& loop)
+    {
+        auto first_e = loop.edge;
+        auto curr_e = first_e;
+        do {
+            hash_combine(seed, vert2idx[curr_e->vert]);
+            curr_e = curr_e->next;
+        } while (curr_e && curr_e != first_e);
+
+        // loop end
+        hash_combine(seed, static_cast<size_t>(-1));
+    };
+    for (auto& face : m_faces)
+    {
+        hash_loop(*face.border);
+        for (auto& hole : face.holes) {
+            hash_loop(*hole);
+        }
+
+        // face end
+        hash_combine(seed, static_cast<size_t>(-2));
+    }
+
+    m_hash = seed == 0 ? 1 : seed;
+    return m_hash;
+}
+
+void Polyhedron::BeginTransaction()
+{
+    Commit();
+    m_log = new EditLog(*this);
+}
+
+void Polyhedron::Commit()
+{
+    if (m_log) {
+        m_log->Commit();
+        delete m_log;
+        m_log = nullptr;
+    }
+}
+
+void Polyhedron::Rollback()
+{
+    if (m_log) {
+        m_log->Rollback();
+        delete m_log;
+        m_log = nullptr;
     }
 }
 
@@ -119,6 +228,8 @@ void Polyhedron::OffsetTopoID(size_t v_off, size_t e_off, size_t f_off)
 
 void Polyhedron::Clear()
 {
+    Commit();
+
     m_next_vert_id = 0;
     m_next_edge_id = 0;
     m_next_loop_id = 0;
@@ -130,6 +241,35 @@ void Polyhedron::Clear()
     m_loops.Clear();
 
     m_aabb.MakeEmpty();
+    m_aabb_dirty = false;
+
+    m_hash = 0;
+}
+
+void Polyhedron::CombineAABB(const sm::vec3& pos)
+{
+    if (!m_aabb_dirty) {
+        m_aabb.Combine(pos);
+    }
+}
+
+void Polyhedron::CombineAABB(const sm::cube& aabb)
+{
+    if (!m_aabb_dirty && aabb.IsValid()) {
+        m_aabb.Combine(aabb);
+    }
+}
+
+void Polyhedron::ShrinkAABB(const sm::vec3& pos)
+{
+    if (!m_aabb_dirty && Utility::IsPointOnAABB(m_aabb, pos)) {
+        m_aabb_dirty = true;
+    }
+}
+
+void Polyhedron::SetAABBDirty()
+{
+    m_aabb_dirty = true;
 }
 
 std::vector<Polyhedron::in_vert>
@@ -1,7 +1,16 @@
 #include "halfedge/Polyhedron.h"
+#include "halfedge/Polyline.h"
 #include "halfedge/Utility.h"
+#include "halfedge/BSPTree.h"
+#include "halfedge/SpatialHash.h"
+#include "halfedge/CancelToken.h"
+
+#include <SM_Calc.h>
 
 #include <iterator>
+#include <algorithm>
+#include <numeric>
+#include <set>
 
 namespace
 {
@@ -21,6 +30,407 @@ bool IsPolyhedronClosed(const he::Polyhedron& poly)
     return true;
 }
 
+// convex faces, and each edge folds inward,
+// the twin's face lies below the face plane
+bool IsPolyhedronConvex(const he::Polyhedron& poly)
+{
+    using PointStatus = he::Utility::PointStatus;
+
+    for (auto& face : poly.GetFaces())
+    {
+        if (!face.border || !face.holes.empty()) {
+            return false;
+        }
+
+        sm::Plane plane;
+        he::Utility::LoopToPlane(*face.border, plane);
+
+        auto first_e = face.border->edge;
+        auto curr_e = first_e;
+        do {
+            auto& p0 = curr_e->vert->position;
+            auto& p1 = curr_e->next->vert->position;
+            auto& p2 = curr_e->next->next->vert->position;
+            if ((p1 - p0).Cross(p2 - p1).Dot(plane.normal) < 0) {
+                return false;
+            }
+
+            if (curr_e->twin)
+            {
+                auto opposite = curr_e->twin->next->next->vert;
+                if (he::Utility::CalcPointPlaneStatus(plane, opposite->position) == PointStatus::Above) {
+                    return false;
+                }
+            }
+
+            curr_e = curr_e->next;
+        } while (curr_e != first_e);
+    }
+
+    return true;
+}
+
+enum class AABBStatus
+{
+    Outside,
+    Inside,
+    Unknown,
+};
+
+// the box against the face planes of a convex solid
+AABBStatus CalcAABBConvexStatus(const sm::cube& aabb, const he::Polyhedron& convex)
+{
+    using PointStatus = he::Utility::PointStatus;
+
+    bool inside = true;
+    for (auto& face : convex.GetFaces())
+    {
+        sm::Plane plane;
+        he::Utility::LoopToPlane(*face.border, plane);
+        switch (he::Utility::CalcAABBPlaneStatus(aabb, plane))
+        {
+        case PointStatus::Above:
+            return AABBStatus::Outside;
+        case PointStatus::Inside:
+            inside = false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return inside ? AABBStatus::Inside : AABBStatus::Unknown;
+}
+
+// the box first, then the verts
+he::Utility::FaceStatus CalcPlaneStatus(const he::Polyhedron& poly, const sm::Plane& plane)
+{
+    using PointStatus = he::Utility::PointStatus;
+    using FaceStatus  = he::Utility::FaceStatus;
+
+    switch (he::Utility::CalcAABBPlaneStatus(poly.GetAABB(), plane))
+    {
+    case PointStatus::Above:
+        return FaceStatus::Above;
+    case PointStatus::Below:
+        return FaceStatus::Below;
+    default:
+        return he::Utility::CalcPolyhedronPlaneStatus(poly, plane);
+    }
+}
+
+// overlap or touch, flat boxes of axis aligned faces still meet
+bool IsAABBTouch(const sm::cube& a, const sm::cube& b)
+{
+    const float eps = he::Utility::POINT_STATUS_EPSILON;
+    for (int i = 0; i < 3; ++i) {
+        if (a.max[i] < b.min[i] - eps || b.max[i] < a.min[i] - eps) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct CurveFace
+{
+    // border and holes
+    std::vector<std::vector<sm::vec3>> loops;
+    sm::Plane plane;
+    sm::cube aabb;
+};
+
+void BuildCurveFaces(const he::Polyhedron& poly, std::vector<CurveFace>& faces)
+{
+    faces.reserve(poly.GetFaces().size());
+    for (auto& src : poly.GetFaces())
+    {
+        CurveFace dst;
+        dst.loops.emplace_back();
+        he::Utility::LoopToVertices(*src.border, dst.loops.back());
+        if (dst.loops.back().size() < 3) {
+            continue;
+        }
+        he::Utility::LoopToPlane(*src.border, dst.plane);
+        for (auto& hole : src.holes) {
+            dst.loops.emplace_back();
+            he::Utility::LoopToVertices(*hole, dst.loops.back());
+        }
+
+        for (auto& loop : dst.loops) {
+            for (auto& pos : loop) {
+                dst.aabb.Combine(pos);
+            }
+        }
+        faces.push_back(dst);
+    }
+}
+
+// bvh over boxes, median split on the longest axis
+class BoxBVH
+{
+public:
+    BoxBVH(const std::vector<sm::cube>& boxes)
+        : m_boxes(boxes)
+    {
+        m_indices.resize(boxes.size());
+        std::iota(m_indices.begin(), m_indices.end(), 0);
+        if (!boxes.empty()) {
+            Build(0, boxes.size());
+        }
+    }
+
+    // visit(idx) the boxes which touch aabb
+    template <typename Visit>
+    void Query(const sm::cube& aabb, Visit visit) const
+    {
+        if (m_nodes.empty()) {
+            return;
+        }
+
+        std::vector<size_t> buf;
+        buf.push_back(0);
+        while (!buf.empty())
+        {
+            auto& node = m_nodes[buf.back()];
+            buf.pop_back();
+            if (!IsAABBTouch(node.aabb, aabb)) {
+                continue;
+            }
+
+            if (node.left == NIL)
+            {
+                for (size_t i = node.begin; i < node.end; ++i) {
+                    if (IsAABBTouch(m_boxes[m_indices[i]], aabb)) {
+                        visit(m_indices[i]);
+                    }
+                }
+            }
+            else
+            {
+                buf.push_back(node.left);
+                buf.push_back(node.right);
+            }
+        }
+    }
+
+private:
+    size_t Build(size_t begin, size_t end)
+    {
+        const size_t idx = m_nodes.size();
+        m_nodes.push_back({ sm::cube(), begin, end, NIL, NIL });
+
+        sm::cube aabb;
+        for (size_t i = begin; i < end; ++i) {
+            aabb.Combine(m_boxes[m_indices[i]]);
+        }
+        m_nodes[idx].aabb = aabb;
+
+        if (end - begin <= LEAF_SIZE) {
+            return idx;
+        }
+
+        int axis = 0;
+        for (int i = 1; i < 3; ++i) {
+            if (aabb.max[i] - aabb.min[i] > aabb.max[axis] - aabb.min[axis]) {
+                axis = i;
+            }
+        }
+
+        const size_t mid = (begin + end) / 2;
+        std::nth_element(m_indices.begin() + begin, m_indices.begin() + mid, m_indices.begin() + end,
+            [&](size_t a, size_t b) {
+                auto& ba = m_boxes[a];
+                auto& bb = m_boxes[b];
+                return ba.min[axis] + ba.max[axis] < bb.min[axis] + bb.max[axis];
+            });
+
+        const size_t left = Build(begin, mid);
+        const size_t right = Build(mid, end);
+        m_nodes[idx].left = left;
+        m_nodes[idx].right = right;
+
+        return idx;
+    }
+
+private:
+    static const size_t NIL = static_cast<size_t>(-1);
+    static const size_t LEAF_SIZE = 4;
+
+    struct Node
+    {
+        sm::cube aabb;
+        size_t begin, end;
+        size_t left, right;
+    };
+
+    const std::vector<sm::cube>& m_boxes;
+
+    std::vector<size_t> m_indices;
+    std::vector<Node> m_nodes;
+
+}; // BoxBVH
+
+// where the face's loops cross the plane, sorted along dir,
+// pairs of them are the parts of the line inside the face
+void CalcFaceCrossings(const CurveFace& face, const sm::Plane& plane, const sm::vec3& dir,
+                       std::vector<std::pair<float, sm::vec3>>& crossings)
+{
+    using PointStatus = he::Utility::PointStatus;
+
+    crossings.clear();
+    for (auto& loop : face.loops)
+    {
+        for (size_t i = 0, n = loop.size(); i < n; ++i)
+        {
+            auto& p0 = loop[i];
+            auto& p1 = loop[(i + 1) % n];
+
+            // on plane counts as above, so a vert on it crosses once
+            const auto s0 = he::Utility::CalcPointPlaneStatus(plane, p0);
+            const auto s1 = he::Utility::CalcPointPlaneStatus(plane, p1);
+            if ((s0 != PointStatus::Below) == (s1 != PointStatus::Below)) {
+                continue;
+            }
+
+            sm::vec3 pos;
+            if (s0 == PointStatus::Inside) {
+                pos = p0;
+            } else if (s1 == PointStatus::Inside) {
+                pos = p1;
+            } else {
+                const double d0 = he::Utility::CalcPointPlaneDistance(plane, p0);
+                const double d1 = he::Utility::CalcPointPlaneDistance(plane, p1);
+                pos = p0 + (p1 - p0) * static_cast<float>(d0 / (d0 - d1));
+            }
+            crossings.push_back({ dir.Dot(pos), pos });
+        }
+    }
+
+    std::sort(crossings.begin(), crossings.end(),
+        [](const std::pair<float, sm::vec3>& a, const std::pair<float, sm::vec3>& b) {
+            return a.first < b.first;
+        });
+}
+
+void CalcFaceFaceSegments(const CurveFace& f0, const CurveFace& f1,
+                          std::vector<std::pair<sm::vec3, sm::vec3>>& segments)
+{
+    const float eps = he::Utility::POINT_STATUS_EPSILON;
+
+    auto dir = f0.plane.normal.Cross(f1.plane.normal);
+    if (dir.Length() < eps) {
+        return;
+    }
+    dir.Normalize();
+
+    std::vector<std::pair<float, sm::vec3>> c0, c1;
+    CalcFaceCrossings(f0, f1.plane, dir, c0);
+    CalcFaceCrossings(f1, f0.plane, dir, c1);
+
+    // overlap of the two interval lists
+    size_t i = 0, j = 0;
+    while (i + 1 < c0.size() && j + 1 < c1.size())
+    {
+        auto& begin = c0[i].first > c1[j].first ? c0[i] : c1[j];
+        auto& end = c0[i + 1].first < c1[j + 1].first ? c0[i + 1] : c1[j + 1];
+        if (end.first - begin.first > eps) {
+            segments.push_back({ begin.second, end.second });
+        }
+
+        if (c0[i + 1].first < c1[j + 1].first) {
+            i += 2;
+        } else {
+            j += 2;
+        }
+    }
+}
+
+// weld the segments and walk them into chains, open ones first
+he::PolylinePtr BuildCurves(const std::vector<std::pair<sm::vec3, sm::vec3>>& segments)
+{
+    const float eps = he::Utility::POINT_STATUS_EPSILON;
+
+    std::vector<std::pair<he::TopoID, sm::vec3>> verts;
+    he::SpatialHash<size_t> weld(eps);
+    auto add_vert = [&](const sm::vec3& pos) -> size_t
+    {
+        size_t idx = verts.size();
+        weld.Query(pos, eps, [&](const sm::vec3&, size_t i) -> bool {
+            idx = i;
+            return true;
+        });
+        if (idx == verts.size()) {
+            weld.Insert(pos, idx);
+            verts.push_back({ he::TopoID(), pos });
+        }
+        return idx;
+    };
+
+    // the same segment may come from the faces on both sides of an edge
+    std::set<std::pair<size_t, size_t>> unique;
+    std::vector<std::pair<size_t, size_t>> edges;
+    for (auto& seg : segments)
+    {
+        const size_t v0 = add_vert(seg.first);
+        const size_t v1 = add_vert(seg.second);
+        if (v0 == v1 || !unique.insert({ std::min(v0, v1), std::max(v0, v1) }).second) {
+            continue;
+        }
+        edges.push_back({ v0, v1 });
+    }
+    if (edges.empty()) {
+        return nullptr;
+    }
+
+    std::vector<std::vector<size_t>> vert2edges(verts.size());
+    for (size_t i = 0, n = edges.size(); i < n; ++i) {
+        vert2edges[edges[i].first].push_back(i);
+        vert2edges[edges[i].second].push_back(i);
+    }
+
+    std::vector<std::pair<he::TopoID, std::vector<size_t>>> polylines;
+    std::vector<bool> used(edges.size(), false);
+    auto walk = [&](size_t start)
+    {
+        for (auto& e : vert2edges[start])
+        {
+            if (used[e]) {
+                continue;
+            }
+
+            std::vector<size_t> chain;
+            chain.push_back(start);
+            size_t curr_v = start, curr_e = e;
+            while (true)
+            {
+                used[curr_e] = true;
+                curr_v = edges[curr_e].first == curr_v ? edges[curr_e].second : edges[curr_e].first;
+                chain.push_back(curr_v);
+                if (curr_v == start || vert2edges[curr_v].size() != 2) {
+                    break;
+                }
+
+                auto& next = vert2edges[curr_v];
+                curr_e = next[0] == curr_e ? next[1] : next[0];
+                if (used[curr_e]) {
+                    break;
+                }
+            }
+            polylines.push_back({ he::TopoID(), chain });
+        }
+    };
+    for (size_t i = 0, n = verts.size(); i < n; ++i) {
+        if (vert2edges[i].size() != 2) {
+            walk(i);
+        }
+    }
+    for (size_t i = 0, n = verts.size(); i < n; ++i) {
+        walk(i);
+    }
+
+    return std::make_shared<he::Polyline>(verts, polylines);
+}
+
 std::shared_ptr<he::Polyhedron>
 DoIntersect(const he::Polyhedron& poly0, const he::Polyhedron& poly1)
 {
@@ -38,9 +448,16 @@ DoIntersect(const he::Polyhedron& poly0, const he::Polyhedron& poly1)
         sm::Plane plane;
         he::Utility::LoopToPlane(*curr_l, plane);
 
-        bool succ = ret->Clip(plane, he::Polyhedron::KeepType::KeepBelow, true);
-        if (!succ) {
+        switch (he::Utility::CalcAABBPlaneStatus(ret->GetAABB(), plane))
+        {
+        case he::Utility::PointStatus::Above:
             return nullptr;
+        case he::Utility::PointStatus::Below:
+            break;
+        default:
+            if (!ret->Clip(plane, he::Polyhedron::KeepType::KeepBelow, true)) {
+                return nullptr;
+            }
         }
         if (ret->GetFaces().empty()) {
             return ret;
@@ -52,35 +469,275 @@ DoIntersect(const he::Polyhedron& poly0, const he::Polyhedron& poly1)
     return ret;
 }
 
-void DoSubtract(std::vector<he::PolyhedronPtr>& result, const std::vector<he::PolyhedronPtr>& fragments,
-                const he::loop3* curr_l, const he::loop3* first_l)
+// a serial chain on the owned frag: the back part of each plane goes on to
+// the next one, the front part is copied out and passed to the sink at once
+void DoSubtract(const he::Polyhedron::FragmentSink& sink, he::PolyhedronPtr frag,
+                const std::vector<sm::Plane>& planes, he::CancelToken* cancel)
 {
-    if (fragments.empty()) {
+    using FaceStatus = he::Utility::FaceStatus;
+    using KeepType   = he::Polyhedron::KeepType;
+
+    for (size_t i = 0, n = planes.size(); i < n && frag; ++i)
+    {
+        auto& plane = planes[i];
+        switch (CalcPlaneStatus(*frag, plane))
+        {
+        case FaceStatus::Above:
+            sink(frag);
+            frag.reset();
+            break;
+        case FaceStatus::Below:
+            break;
+        default:
+            // frag is owned, so clip it in place:
+            // copy only the front part and rollback, then keep the back part
+            frag->BeginTransaction();
+            if (frag->Clip(plane, KeepType::KeepAbove, true))
+            {
+                auto front = std::make_shared<he::Polyhedron>(*frag);
+                frag->Rollback();
+                sink(front);
+            }
+            else
+            {
+                frag->Rollback();
+            }
+
+            if (!frag->Clip(plane, KeepType::KeepBelow, true)) {
+                frag.reset();
+            }
+            break;
+        }
+
+        if (cancel && !cancel->Check()) {
+            return;
+        }
+    }
+}
+
+// frag is poly when it is owned, then it is passed on or clipped in place,
+// else poly is copied only if something is left
+void SubtractFrag(const he::Polyhedron& poly, he::PolyhedronPtr frag, const he::Polyhedron& subtrahend,
+                  const he::Polyhedron::FragmentSink& sink, he::CancelToken* cancel)
+{
+    auto own = [&]() {
+        return frag ? frag : std::make_shared<he::Polyhedron>(poly);
+    };
+
+    // broad phase
+    if (!he::Utility::IsAABBOverlap(poly.GetAABB(), subtrahend.GetAABB()))
+    {
+        sink(own());
         return;
     }
 
+    if (!IsPolyhedronConvex(poly) || !IsPolyhedronConvex(subtrahend))
+    {
+        he::BSPTree::Subtract(he::BSPTree(poly), he::BSPTree(subtrahend), sink, cancel);
+        return;
+    }
+
+    switch (CalcAABBConvexStatus(poly.GetAABB(), subtrahend))
+    {
+    case AABBStatus::Outside:
+        sink(own());
+        return;
+    case AABBStatus::Inside:
+        return;
+    default:
+        break;
+    }
+
+    auto& faces = subtrahend.GetFaces();
+    if (faces.empty()) {
+        return;
+    }
+
+    // all the loops from the first border
+    std::vector<sm::Plane> planes;
+    planes.reserve(subtrahend.GetLoops().Size());
+    auto first_l = faces.front().border;
+    auto curr_l = first_l;
+    do {
+        planes.emplace_back();
+        he::Utility::LoopToPlane(*curr_l, planes.back());
+        curr_l = curr_l->linked_next;
+    } while (curr_l != first_l);
+
+    DoSubtract(sink, own(), planes, cancel);
+}
+
+struct FragFace
+{
+    size_t poly;
+    std::vector<sm::vec3> border;
     sm::Plane plane;
-    he::Utility::LoopToPlane(*curr_l, plane);
+};
 
-    std::vector<he::PolyhedronPtr> back_frags;
+float CalcPolygonArea(const std::vector<sm::vec3>& polygon)
+{
+    sm::vec3 sum;
+    for (size_t i = 0, n = polygon.size(); i < n; ++i) {
+        sum += polygon[i].Cross(polygon[(i + 1) % n]);
+    }
+    return sum.Length() * 0.5f;
+}
 
-    for (auto& frag : fragments)
+// no corner turns back seen along the normal, the straight ones are allowed
+bool IsPolygonConvex(const std::vector<sm::vec3>& polygon, const sm::vec3& normal)
+{
+    for (size_t i = 0, n = polygon.size(); i < n; ++i)
     {
-        auto frag_in_front = std::make_shared<he::Polyhedron>(*frag);
-        if (frag_in_front->Clip(plane, he::Polyhedron::KeepType::KeepAbove, true)) {
-            result.push_back(frag_in_front);
+        auto d0 = polygon[i] - polygon[(i + n - 1) % n];
+        auto d1 = polygon[(i + 1) % n] - polygon[i];
+        const float eps = he::Utility::POINT_STATUS_EPSILON * d0.Length() * d1.Length();
+        if (d0.Cross(d1).Dot(normal) < -eps) {
+            return false;
         }
+    }
+    return true;
+}
 
-        auto fragment_behind = std::make_shared<he::Polyhedron>(*frag);
-        if (fragment_behind->Clip(plane, he::Polyhedron::KeepType::KeepBelow, true)) {
-            back_frags.push_back(fragment_behind);
+// same point for the same plane, planes apart in normal or in dist
+// get points apart, while scale is larger than all the dists
+sm::vec3 CalcPlaneKey(const sm::vec3& normal, float dist, float scale)
+{
+    return normal * (scale - dist);
+}
+
+size_t FindRoot(std::vector<size_t>& parents, size_t i)
+{
+    while (parents[i] != i) {
+        parents[i] = parents[parents[i]];
+        i = parents[i];
+    }
+    return i;
+}
+
+// cut off the part of the polygon covered by the convex cover,
+// return false if nothing is covered
+bool CutPolygon(const std::vector<sm::vec3>& polygon, const FragFace& cover,
+                std::vector<std::vector<sm::vec3>>& remain)
+{
+    const float min_area = he::Utility::POINT_STATUS_EPSILON * he::Utility::POINT_STATUS_EPSILON;
+
+    std::vector<std::vector<sm::vec3>> outside;
+    std::vector<sm::vec3> curr = polygon, above, below;
+    for (size_t i = 0, n = cover.border.size(); i < n; ++i)
+    {
+        auto& p0 = cover.border[i];
+        auto& p1 = cover.border[(i + 1) % n];
+
+        // the cover is ccw around its normal, above is out of the edge
+        sm::Plane plane;
+        plane.Build((p1 - p0).Cross(cover.plane.normal), p0);
+        he::Utility::SplitPolygon(curr, plane, above, below);
+        if (below.empty() || CalcPolygonArea(below) < min_area) {
+            return false;
         }
+        if (!above.empty() && CalcPolygonArea(above) >= min_area) {
+            outside.push_back(above);
+        }
+        curr = below;
     }
 
-    curr_l = curr_l->linked_next;
-    if (curr_l != first_l) {
-        DoSubtract(result, back_frags, curr_l, first_l);
+    std::copy(outside.begin(), outside.end(), std::back_inserter(remain));
+    return true;
+}
+
+// weld the polygons and split their edges at the verts on them
+he::PolyhedronPtr BuildFromPolygons(const std::vector<std::vector<sm::vec3>>& polygons)
+{
+    const float eps = he::Utility::POINT_STATUS_EPSILON;
+
+    std::vector<he::Polyhedron::in_vert> verts;
+    std::vector<std::vector<size_t>> loops;
+    loops.reserve(polygons.size());
+
+    he::SpatialHash<size_t> weld(eps);
+    double len_sum = 0;
+    size_t len_num = 0;
+    for (auto& polygon : polygons)
+    {
+        std::vector<size_t> loop;
+        for (auto& pos : polygon)
+        {
+            size_t idx = verts.size();
+            weld.Query(pos, eps, [&](const sm::vec3&, size_t i) -> bool {
+                idx = i;
+                return true;
+            });
+            if (idx == verts.size()) {
+                weld.Insert(pos, idx);
+                verts.push_back({ he::TopoID(), pos });
+            }
+            if (loop.empty() || loop.back() != idx) {
+                loop.push_back(idx);
+            }
+        }
+        while (loop.size() > 1 && loop.front() == loop.back()) {
+            loop.pop_back();
+        }
+        if (loop.size() < 3) {
+            continue;
+        }
+
+        for (size_t i = 0, n = loop.size(); i < n; ++i) {
+            auto d = verts[loop[(i + 1) % n]].second - verts[loop[i]].second;
+            len_sum += d.Length();
+            ++len_num;
+        }
+        loops.push_back(loop);
+    }
+
+    if (loops.empty()) {
+        return nullptr;
+    }
+
+    he::SpatialHash<size_t> grid(std::max(eps, static_cast<float>(len_sum / len_num)));
+    grid.Reserve(verts.size());
+    for (size_t i = 0, n = verts.size(); i < n; ++i) {
+        grid.Insert(verts[i].second, i);
+    }
+
+    std::vector<he::Polyhedron::in_face> faces;
+    faces.reserve(loops.size());
+    std::vector<std::pair<float, size_t>> on_edge;
+    for (auto& loop : loops)
+    {
+        he::Polyhedron::in_loop dst;
+        for (size_t i = 0, n = loop.size(); i < n; ++i)
+        {
+            const size_t i0 = loop[i];
+            const size_t i1 = loop[(i + 1) % n];
+            dst.push_back(i0);
+
+            auto& p0 = verts[i0].second;
+            auto& p1 = verts[i1].second;
+            const auto d = p1 - p0;
+            const float len = d.Length();
+
+            on_edge.clear();
+            grid.Query((p0 + p1) * 0.5f, len * 0.5f + eps, [&](const sm::vec3& pos, size_t idx) -> bool
+            {
+                if (idx == i0 || idx == i1) {
+                    return false;
+                }
+                const float t = (pos - p0).Dot(d) / (len * len);
+                if (t > 0 && t < 1 && sm::dis_pos3_to_pos3(p0 + d * t, pos) < eps) {
+                    on_edge.push_back({ t, idx });
+                }
+                return false;
+            });
+            std::sort(on_edge.begin(), on_edge.end());
+            for (auto& v : on_edge) {
+                dst.push_back(v.second);
+            }
+        }
+        faces.push_back({ he::TopoID(), dst, {} });
     }
+
+    return std::make_shared<he::Polyhedron>(verts, faces);
 }
 
 }
@@ -88,19 +745,63 @@ void DoSubtract(std::vector<he::PolyhedronPtr>& result, const std::vector<he::Po
 namespace he
 {
 
-std::vector<PolyhedronPtr> Polyhedron::Union(const Polyhedron& other) const
+std::vector<PolyhedronPtr> Polyhedron::Union(const Polyhedron& other, bool merge, CancelToken* cancel) const
 {
+    std::vector<PolyhedronPtr> ret;
+    Union(other, [&ret](const PolyhedronPtr& frag) {
+        ret.push_back(frag);
+    }, cancel);
+    if (cancel && cancel->IsCancelled()) {
+        return {};
+    }
+    return merge ? MergeFragments(ret) : ret;
+}
+
+void Polyhedron::Union(const Polyhedron& other, const FragmentSink& sink, CancelToken* cancel) const
+{
+    if (cancel && cancel->IsCancelled()) {
+        return;
+    }
+
+    // broad phase
+    if (!Utility::IsAABBOverlap(GetAABB(), other.GetAABB()))
+    {
+        sink(std::make_shared<Polyhedron>(*this));
+        sink(std::make_shared<Polyhedron>(other));
+        return;
+    }
+
+    if (!IsPolyhedronConvex(*this) || !IsPolyhedronConvex(other))
+    {
+        BSPTree::Union(BSPTree(*this), BSPTree(other), sink, cancel);
+        return;
+    }
+
+    if (CalcAABBConvexStatus(GetAABB(), other) == AABBStatus::Inside)
+    {
+        sink(std::make_shared<Polyhedron>(other));
+        return;
+    }
+    if (CalcAABBConvexStatus(other.GetAABB(), *this) == AABBStatus::Inside)
+    {
+        sink(std::make_shared<Polyhedron>(*this));
+        return;
+    }
+
     auto intersected = Intersect(other);
-    if (!intersected || intersected->GetFaces().empty()) {
-        return { std::make_shared<he::Polyhedron>(*this), std::make_shared<he::Polyhedron>(other) };
+    if (!intersected || intersected->GetFaces().empty())
+    {
+        sink(std::make_shared<Polyhedron>(*this));
+        sink(std::make_shared<Polyhedron>(other));
+        return;
     }
- 
-    auto ret = Subtract(*intersected);
 
-    auto polys = other.Subtract(*intersected);
-    std::copy(polys.begin(), polys.end(), std::back_inserter(ret));
+    if (cancel && cancel->IsCancelled()) {
+        return;
+    }
 
-    return ret;
+    Subtract(*intersected, sink, cancel);
+    other.Subtract(*intersected, sink, cancel);
 }
 
 PolyhedronPtr Polyhedron::Intersect(const Polyhedron& other) const
@@ -109,12 +810,47 @@ PolyhedronPtr Polyhedron::Intersect(const Polyhedron& other) const
         return nullptr;
     }
 
+    // broad phase
+    if (!Utility::IsAABBOverlap(GetAABB(), other.GetAABB())) {
+        return nullptr;
+    }
+
     bool is_closed0 = IsPolyhedronClosed(*this);
     bool is_closed1 = IsPolyhedronClosed(other);
     if (!is_closed0 && !is_closed1) {
         return nullptr;
     }
 
+    // concave, the touching fragments are merged, the others stay as separate shells
+    if (is_closed0 && is_closed1 &&
+        (!IsPolyhedronConvex(*this) || !IsPolyhedronConvex(other)))
+    {
+        auto frags = MergeFragments(BSPTree::Intersect(BSPTree(*this), BSPTree(other)));
+        if (frags.empty()) {
+            return nullptr;
+        }
+        for (size_t i = 1, n = frags.size(); i < n; ++i) {
+            frags[0]->Join(frags[i], Utility::POINT_STATUS_EPSILON);
+        }
+        return frags[0];
+    }
+
+    if (is_closed0 && is_closed1)
+    {
+        switch (CalcAABBConvexStatus(GetAABB(), other))
+        {
+        case AABBStatus::Outside:
+            return nullptr;
+        case AABBStatus::Inside:
+            return std::make_shared<Polyhedron>(*this);
+        default:
+            break;
+        }
+        if (CalcAABBConvexStatus(other.GetAABB(), *this) == AABBStatus::Inside) {
+            return std::make_shared<Polyhedron>(other);
+        }
+    }
+
     if (is_closed0) {
         return DoIntersect(*this, other);
     } else {
@@ -122,17 +858,270 @@ PolyhedronPtr Polyhedron::Intersect(const Polyhedron& other) const
     }
 }
 
-std::vector<PolyhedronPtr> Polyhedron::Subtract(const Polyhedron& subtrahend) const
+std::vector<PolyhedronPtr> Polyhedron::Subtract(const Polyhedron& subtrahend, bool merge, CancelToken* cancel) const
 {
     std::vector<PolyhedronPtr> ret;
+    Subtract(subtrahend, [&ret](const PolyhedronPtr& frag) {
+        ret.push_back(frag);
+    }, cancel);
+    if (cancel && cancel->IsCancelled()) {
+        return {};
+    }
+    return merge ? MergeFragments(ret) : ret;
+}
 
-    auto& faces = subtrahend.GetFaces();
-    if (!faces.empty()) {
-        auto first_l = faces.front().border;
-        DoSubtract(ret, { std::make_shared<Polyhedron>(*this) }, first_l, first_l);
+void Polyhedron::Subtract(const Polyhedron& subtrahend, const FragmentSink& sink, CancelToken* cancel) const
+{
+    if (cancel && cancel->IsCancelled()) {
+        return;
+    }
+
+    SubtractFrag(*this, nullptr, subtrahend, sink, cancel);
+}
+
+std::vector<PolyhedronPtr> Polyhedron::Subtract(const std::vector<PolyhedronPtr>& subtrahends, bool merge,
+                                                CancelToken* cancel) const
+{
+    std::vector<PolyhedronPtr> ret;
+    Subtract(subtrahends, [&ret](const PolyhedronPtr& frag) {
+        ret.push_back(frag);
+    }, cancel);
+    if (cancel && cancel->IsCancelled()) {
+        return {};
+    }
+    return merge ? MergeFragments(ret) : ret;
+}
+
+void Polyhedron::Subtract(const std::vector<PolyhedronPtr>& subtrahends, const FragmentSink& sink,
+                          CancelToken* cancel) const
+{
+    if (cancel && cancel->IsCancelled()) {
+        return;
+    }
+
+    // index the cutters by box
+    std::vector<size_t> cutters;
+    std::vector<sm::cube> boxes;
+    for (size_t i = 0, n = subtrahends.size(); i < n; ++i)
+    {
+        if (subtrahends[i] && Utility::IsAABBOverlap(GetAABB(), subtrahends[i]->GetAABB())) {
+            cutters.push_back(i);
+            boxes.push_back(subtrahends[i]->GetAABB());
+        }
+    }
+
+    if (cutters.empty())
+    {
+        sink(std::make_shared<Polyhedron>(*this));
+        return;
+    }
+
+    BoxBVH index(boxes);
+
+    // rounds: each frag is cut by its first overlapping cutter after the last one,
+    // the pieces go on to the next round, frags without cutters are done,
+    // the frags are owned so they are cut in place
+    std::vector<std::pair<PolyhedronPtr, size_t>> frags;
+    frags.push_back({ std::make_shared<Polyhedron>(*this), 0 });
+    while (!frags.empty())
+    {
+        std::vector<std::pair<size_t, std::vector<PolyhedronPtr>>> pieces(frags.size());
+        Utility::ParallelFor(frags.size(), [&](size_t i)
+        {
+            auto& frag = frags[i].first;
+            auto& aabb = frag->GetAABB();
+
+            size_t cutter = subtrahends.size();
+            index.Query(aabb, [&](size_t j)
+            {
+                const size_t idx = cutters[j];
+                if (idx >= frags[i].second && idx < cutter && Utility::IsAABBOverlap(aabb, boxes[j])) {
+                    cutter = idx;
+                }
+            });
+
+            auto& dst = pieces[i].second;
+            pieces[i].first = cutter;
+            if (cutter == subtrahends.size()) {
+                dst.push_back(frag);
+            } else {
+                SubtractFrag(*frag, frag, *subtrahends[cutter], [&dst](const PolyhedronPtr& p) {
+                    dst.push_back(p);
+                }, cancel);
+            }
+        });
+
+        // the pieces of a cancelled round are not complete
+        if (cancel && cancel->IsCancelled()) {
+            return;
+        }
+
+        std::vector<std::pair<PolyhedronPtr, size_t>> next;
+        for (auto& p : pieces)
+        {
+            if (p.first == subtrahends.size())
+            {
+                for (auto& poly : p.second) {
+                    sink(poly);
+                }
+                continue;
+            }
+            for (auto& poly : p.second) {
+                next.push_back({ poly, p.first + 1 });
+            }
+        }
+        frags.swap(next);
+    }
+}
+
+PolylinePtr Polyhedron::CalcIntersectCurves(const Polyhedron& other) const
+{
+    if (!IsAABBTouch(GetAABB(), other.GetAABB())) {
+        return nullptr;
+    }
+
+    std::vector<CurveFace> faces0, faces1;
+    BuildCurveFaces(*this, faces0);
+    BuildCurveFaces(other, faces1);
+
+    std::vector<sm::cube> boxes1;
+    boxes1.reserve(faces1.size());
+    for (auto& f : faces1) {
+        boxes1.push_back(f.aabb);
+    }
+    BoxBVH bvh(boxes1);
+
+    // segments kept by face, the same order for any thread num
+    std::vector<std::vector<std::pair<sm::vec3, sm::vec3>>> segments(faces0.size());
+    Utility::ParallelFor(faces0.size(), [&](size_t i)
+    {
+        if (!IsAABBTouch(faces0[i].aabb, other.GetAABB())) {
+            return;
+        }
+        bvh.Query(faces0[i].aabb, [&](size_t j) {
+            CalcFaceFaceSegments(faces0[i], faces1[j], segments[i]);
+        });
+    });
+
+    std::vector<std::pair<sm::vec3, sm::vec3>> all;
+    for (auto& s : segments) {
+        std::copy(s.begin(), s.end(), std::back_inserter(all));
+    }
+
+    return BuildCurves(all);
+}
+
+std::vector<PolyhedronPtr> Polyhedron::MergeFragments(const std::vector<PolyhedronPtr>& frags)
+{
+    std::vector<FragFace> faces;
+    std::vector<uint8_t> mergeable(frags.size(), 1);
+    float max_dist = 0;
+    for (size_t i = 0, n = frags.size(); i < n; ++i)
+    {
+        // CutPolygon clips by the cover's edges, both faces must be convex
+        const size_t begin = faces.size();
+        for (auto& face : frags[i]->m_faces)
+        {
+            if (!face.border || !face.holes.empty()) {
+                mergeable[i] = 0;
+                break;
+            }
+
+            FragFace dst;
+            dst.poly = i;
+            Utility::LoopToVertices(*face.border, dst.border);
+            Utility::LoopToPlane(*face.border, dst.plane);
+            if (!IsPolygonConvex(dst.border, dst.plane.normal)) {
+                mergeable[i] = 0;
+                break;
+            }
+            faces.push_back(dst);
+        }
+
+        if (!mergeable[i])
+        {
+            faces.resize(begin);
+            continue;
+        }
+        for (size_t j = begin, m = faces.size(); j < m; ++j) {
+            max_dist = std::max(max_dist, fabsf(faces[j].plane.dist));
+        }
+    }
+
+    // opposite faces on the same plane
+    const float eps = Utility::POINT_STATUS_EPSILON;
+    const float scale = max_dist + 1;
+    SpatialHash<size_t> planes(eps);
+    planes.Reserve(faces.size());
+    for (size_t i = 0, n = faces.size(); i < n; ++i) {
+        planes.Insert(CalcPlaneKey(faces[i].plane.normal, faces[i].plane.dist, scale), i);
+    }
+
+    std::vector<size_t> parents(frags.size());
+    std::iota(parents.begin(), parents.end(), 0);
+
+    std::vector<std::vector<std::vector<sm::vec3>>> polygons(frags.size());
+    for (auto& face : faces)
+    {
+        std::vector<std::vector<sm::vec3>> remain = { face.border }, next;
+        auto key = CalcPlaneKey(-face.plane.normal, -face.plane.dist, scale);
+        planes.Query(key, eps, [&](const sm::vec3&, size_t idx) -> bool
+        {
+            auto& cover = faces[idx];
+            if (cover.poly == face.poly) {
+                return false;
+            }
+
+            next.clear();
+            bool covered = false;
+            for (auto& polygon : remain)
+            {
+                if (CutPolygon(polygon, cover, next)) {
+                    covered = true;
+                } else {
+                    next.push_back(polygon);
+                }
+            }
+            remain.swap(next);
+
+            if (covered) {
+                parents[FindRoot(parents, face.poly)] = FindRoot(parents, cover.poly);
+            }
+            return remain.empty();
+        });
+
+        auto& dst = polygons[face.poly];
+        std::copy(remain.begin(), remain.end(), std::back_inserter(dst));
+    }
+
+    // one solid for each group of touching frags
+    std::vector<PolyhedronPtr> ret;
+    std::vector<std::vector<size_t>> groups(frags.size());
+    for (size_t i = 0, n = frags.size(); i < n; ++i) {
+        groups[FindRoot(parents, i)].push_back(i);
+    }
+    for (auto& group : groups)
+    {
+        if (group.empty()) {
+            continue;
+        }
+        if (group.size() == 1)
+        {
+            ret.push_back(frags[group.front()]);
+            continue;
+        }
+
+        std::vector<std::vector<sm::vec3>> group_polygons;
+        for (auto& i : group) {
+            std::copy(polygons[i].begin(), polygons[i].end(), std::back_inserter(group_polygons));
+        }
+        if (auto poly = BuildFromPolygons(group_polygons))
+        {
+            poly->MergeCoplanarFaces();
+            ret.push_back(poly);
+        }
     }
 
-//    return { Fuse(ret) };
     return ret;
 }
 
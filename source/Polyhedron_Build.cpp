@@ -5,7 +5,8 @@ namespace he
 
 vert3* Polyhedron::AddVertex(const sm::vec3& pos)
 {
-    m_aabb.Combine(pos);
+    CombineAABB(pos);
+    m_hash = 0;
 
     auto vert = new he::vert3(pos, he::TopoID());
     m_verts.Append(vert);
@@ -22,6 +23,7 @@ loop3* Polyhedron::AddFace(const std::vector<size_t>& loop_indices, const std::v
     face.border = loop;
     
     m_faces.push_back(face);
+    m_hash = 0;
 
     return loop;
 }
@@ -263,7 +265,7 @@ void Polyhedron::BuildVertices(const std::vector<in_vert>& verts, std::vector<ve
     v_array.reserve(verts.size());
     for (auto& vert : verts)
     {
-        m_aabb.Combine(vert.second);
+        CombineAABB(vert.second);
 
         TopoID topo_id;
         if (vert.first.Empty()) {
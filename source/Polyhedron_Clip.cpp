@@ -1,17 +1,88 @@
 #include "halfedge/Polyhedron.h"
 #include "halfedge/Utility.h"
+#include "halfedge/EditLog.h"
+#include "halfedge/SpatialHash.h"
+#include "halfedge/Circulator.h"
 
 #include <SM_Calc.h>
 
 #include <set>
-#include <map>
 #include <iterator>
+#include <unordered_map>
 
 namespace
 {
 
 using PointStatus = he::Utility::PointStatus;
 
+// edit log helpers, log is null when no transaction
+
+template <typename T>
+void touch(he::EditLog* log, T* item)
+{
+    if (log) {
+        log->Touch(item);
+    }
+}
+
+template <typename T>
+void list_append(he::EditLog* log, he::DoublyLinkedList<T>& list, T* item)
+{
+    if (log)
+    {
+        log->Add(item);
+        if (auto head = list.Head()) {
+            log->Touch(head);
+            log->Touch(head->linked_prev);
+        }
+    }
+    list.Append(item);
+}
+
+template <typename T>
+T* list_remove(he::EditLog* log, he::DoublyLinkedList<T>& list, T* item)
+{
+    if (log)
+    {
+        log->Touch(item);
+        log->Touch(item->linked_prev);
+        log->Touch(item->linked_next);
+    }
+    return list.Remove(item);
+}
+
+template <typename T>
+void delete_elem(he::EditLog* log, T* item)
+{
+    if (log) {
+        log->Delete(item);
+    } else {
+        delete item;
+    }
+}
+
+void append_face(he::EditLog* log, std::vector<he::Polyhedron::Face>& faces, he::loop3* border)
+{
+    if (log) {
+        log->AppendFace();
+    }
+    faces.emplace_back(border);
+}
+
+void bind_loop(he::EditLog* log, he::loop3* loop, he::edge3* edge)
+{
+    if (log)
+    {
+        log->Touch(loop);
+        auto curr_edge = edge;
+        do {
+            log->Touch(curr_edge);
+            curr_edge = curr_edge->next;
+        } while (curr_edge != edge);
+    }
+    he::bind_edge_loop(loop, edge);
+}
+
 PointStatus CheckIntersects(const sm::Plane& plane, const he::DoublyLinkedList<he::vert3>& verts)
 {
     size_t above = 0;
@@ -98,30 +169,36 @@ std::pair<bool, he::edge3*> FindInitialIntersectingEdge(const sm::Plane& plane,
 he::edge3* SplitEdgeByPlane(he::edge3* edge, const sm::Plane& plane,
                             he::DoublyLinkedList<he::vert3>& verts,
                             he::DoublyLinkedList<he::edge3>& edges,
-                            size_t& next_vert_id, size_t& next_edge_id)
+                            size_t& next_vert_id, size_t& next_edge_id, he::EditLog* log)
 {
     auto& s_pos = edge->vert->position;
     auto& e_pos = edge->next->vert->position;
 
-    auto s_dist = plane.GetDistance(s_pos);
-    auto e_dist = plane.GetDistance(e_pos);
+    assert(he::Utility::CalcPointPlaneStatus(plane, s_pos) != PointStatus::Inside
+        && he::Utility::CalcPointPlaneStatus(plane, e_pos) != PointStatus::Inside);
 
-    assert(fabs(s_dist) > he::Utility::POINT_STATUS_EPSILON
-        && fabs(e_dist) > he::Utility::POINT_STATUS_EPSILON
-        && s_dist * e_dist < 0);
+    auto s_dist = he::Utility::CalcPointPlaneDistance(plane, s_pos);
+    auto e_dist = he::Utility::CalcPointPlaneDistance(plane, e_pos);
+    assert(s_dist * e_dist < 0);
 
-    float dot = s_dist / (s_dist - e_dist);
-    assert(dot > 0.0f && dot < 1.0f);
+    double dot = s_dist / (s_dist - e_dist);
+    assert(dot > 0.0 && dot < 1.0);
 
-    auto pos = s_pos + (e_pos - s_pos) * dot;
+    sm::vec3 pos(
+        static_cast<float>(s_pos.x + (static_cast<double>(e_pos.x) - s_pos.x) * dot),
+        static_cast<float>(s_pos.y + (static_cast<double>(e_pos.y) - s_pos.y) * dot),
+        static_cast<float>(s_pos.z + (static_cast<double>(e_pos.z) - s_pos.z) * dot)
+    );
     auto new_vert = new he::vert3(pos, next_vert_id++);
     new_vert->type = he::EditType::Add;
-    verts.Append(new_vert);
+    list_append(log, verts, new_vert);
     auto new_edge = new he::edge3(new_vert, edge->loop, edge->ids);
     new_edge->type = he::EditType::Add;
     new_edge->ids.Append(next_edge_id++);
-    edges.Append(new_edge);
+    list_append(log, edges, new_edge);
 
+    touch(log, edge);
+    touch(log, edge->next);
     edge->type = he::EditType::Mod;
 
     edge->ids.Append(next_edge_id++);
@@ -131,12 +208,14 @@ he::edge3* SplitEdgeByPlane(he::edge3* edge, const sm::Plane& plane,
     auto twin_edge = edge->twin;
     if (twin_edge)
     {
+        touch(log, twin_edge);
+        touch(log, twin_edge->next);
         twin_edge->type = he::EditType::Mod;
 
         auto new_twin_edge = new he::edge3(new_vert, twin_edge->loop, twin_edge->ids);
         new_twin_edge->type = he::EditType::Add;
         new_twin_edge->ids.Append(next_edge_id++);
-        edges.Append(new_twin_edge);
+        list_append(log, edges, new_twin_edge);
 
         twin_edge->ids.Append(next_edge_id++);
         auto twin_edge_next = twin_edge->next;
@@ -156,11 +235,20 @@ void IntersectWithPlane(he::edge3* old_boundary_first,
                         he::DoublyLinkedList<he::edge3>& edges,
                         he::DoublyLinkedList<he::loop3>& loops,
                         size_t& next_edge_id, size_t& next_loop_id,
-                        std::vector<he::Polyhedron::Face>& faces)
+                        std::vector<he::Polyhedron::Face>& faces, he::EditLog* log)
 {
     he::edge3* new_boundary_last = old_boundary_first->prev;
 
     auto old_loop = old_boundary_first->loop;
+
+    // the splitter edges reset vert->edge, and the Connect below relinks these four
+    touch(log, new_boundary_first->vert);
+    touch(log, old_boundary_first->vert);
+    touch(log, old_boundary_first);
+    touch(log, old_boundary_first->prev);
+    touch(log, new_boundary_first);
+    touch(log, new_boundary_first->prev);
+
     he::edge3* old_boundary_splitter = new he::edge3(new_boundary_first->vert, old_loop, next_edge_id++);
     old_boundary_splitter->type = he::EditType::Add;
     he::edge3* new_boundary_splitter = new he::edge3(old_boundary_first->vert, old_loop, next_edge_id++);
@@ -177,16 +265,17 @@ void IntersectWithPlane(he::edge3* old_boundary_first,
     auto new_loop = new he::loop3(new_boundary_first->loop->ids);
     new_loop->type = he::EditType::Add;
     new_loop->ids.Append(next_loop_id++);
-    he::bind_edge_loop(new_loop, new_boundary_first);
+    bind_loop(log, new_loop, new_boundary_first);
 
+    touch(log, old_loop);
     old_loop->ids.Append(next_loop_id++);
-    he::bind_edge_loop(old_loop, old_boundary_first);
+    bind_loop(log, old_loop, old_boundary_first);
 
-    edges.Append(old_boundary_splitter);
-    edges.Append(new_boundary_splitter);
-    loops.Append(new_loop);
+    list_append(log, edges, old_boundary_splitter);
+    list_append(log, edges, new_boundary_splitter);
+    list_append(log, loops, new_loop);
 
-    faces.emplace_back(new_loop);
+    append_face(log, faces, new_loop);
 }
 
 he::edge3* IntersectWithPlane(he::edge3* first_boundary_edge, const sm::Plane& plane,
@@ -194,7 +283,7 @@ he::edge3* IntersectWithPlane(he::edge3* first_boundary_edge, const sm::Plane& p
                               he::DoublyLinkedList<he::edge3>& edges,
                               he::DoublyLinkedList<he::loop3>& loops,
                               size_t& next_vert_id, size_t& next_edge_id, size_t& next_loop_id,
-                              std::vector<he::Polyhedron::Face>& faces)
+                              std::vector<he::Polyhedron::Face>& faces, he::EditLog* log)
 {
     he::edge3* seam_ori = nullptr;
     he::edge3* seam_dst = nullptr;
@@ -218,7 +307,7 @@ he::edge3* IntersectWithPlane(he::edge3* first_boundary_edge, const sm::Plane& p
         else if ((os == PointStatus::Below && ds == PointStatus::Above) ||
                  (os == PointStatus::Above && ds == PointStatus::Below))
         {
-            SplitEdgeByPlane(curr_boundary_edge, plane, verts, edges, next_vert_id, next_edge_id);
+            SplitEdgeByPlane(curr_boundary_edge, plane, verts, edges, next_vert_id, next_edge_id, log);
             curr_boundary_edge = curr_boundary_edge->next;
 
             auto new_vertex = curr_boundary_edge->vert;
@@ -244,9 +333,9 @@ he::edge3* IntersectWithPlane(he::edge3* first_boundary_edge, const sm::Plane& p
         auto os = he::Utility::CalcPointPlaneStatus(plane, seam_ori->next->vert->position);
         assert(os != PointStatus::Inside);
         if (os == PointStatus::Below) {
-            IntersectWithPlane(seam_ori, seam_dst, edges, loops, next_edge_id, next_loop_id, faces);
+            IntersectWithPlane(seam_ori, seam_dst, edges, loops, next_edge_id, next_loop_id, faces, log);
         } else {
-            IntersectWithPlane(seam_dst, seam_ori, edges, loops, next_edge_id, next_loop_id, faces);
+            IntersectWithPlane(seam_dst, seam_ori, edges, loops, next_edge_id, next_loop_id, faces, log);
         }
     }
 
@@ -298,7 +387,7 @@ std::vector<he::edge3*> IntersectWithPlaneImpl(he::edge3* start_edge, const sm::
                                                he::DoublyLinkedList<he::edge3>& edges,
                                                he::DoublyLinkedList<he::loop3>& loops,
                                                size_t& next_vert_id, size_t& next_edge_id, size_t& next_loop_id,
-                                               std::vector<he::Polyhedron::Face>& faces)
+                                               std::vector<he::Polyhedron::Face>& faces, he::EditLog* log)
 {
     std::vector<he::edge3*> seam;
 
@@ -311,7 +400,7 @@ std::vector<he::edge3*> IntersectWithPlaneImpl(he::edge3* start_edge, const sm::
         }
 
         curr_edge = IntersectWithPlane(curr_edge, plane, verts, edges, loops,
-            next_vert_id, next_edge_id, next_loop_id, faces);
+            next_vert_id, next_edge_id, next_loop_id, faces, log);
         seam.push_back(curr_edge);
     } while (curr_edge->next->vert != stop_vert);
 
@@ -327,7 +416,7 @@ std::vector<he::edge3*> IntersectWithPlane(const sm::Plane& plane,
                                            he::DoublyLinkedList<he::edge3>& edges,
                                            he::DoublyLinkedList<he::loop3>& loops,
                                            size_t& next_vert_id, size_t& next_edge_id, size_t& next_loop_id,
-                                           std::vector<he::Polyhedron::Face>& faces)
+                                           std::vector<he::Polyhedron::Face>& faces, he::EditLog* log)
 {
     std::vector<he::edge3*> seam;
 
@@ -338,10 +427,10 @@ std::vector<he::edge3*> IntersectWithPlane(const sm::Plane& plane,
 
         auto init_edge = find.second;
 
-        auto start_edge = IntersectWithPlane(init_edge, plane, verts, edges, loops, next_vert_id, next_edge_id, next_loop_id, faces);
-        seam = IntersectWithPlaneImpl(start_edge, plane, verts, edges, loops, next_vert_id, next_edge_id, next_loop_id, faces);
+        auto start_edge = IntersectWithPlane(init_edge, plane, verts, edges, loops, next_vert_id, next_edge_id, next_loop_id, faces, log);
+        seam = IntersectWithPlaneImpl(start_edge, plane, verts, edges, loops, next_vert_id, next_edge_id, next_loop_id, faces, log);
         if (seam.empty() && start_edge->twin) {
-            seam = IntersectWithPlaneImpl(start_edge->twin, plane, verts, edges, loops, next_vert_id, next_edge_id, next_loop_id, faces);
+            seam = IntersectWithPlaneImpl(start_edge->twin, plane, verts, edges, loops, next_vert_id, next_edge_id, next_loop_id, faces, log);
         }
     }
     else
@@ -370,11 +459,12 @@ bool HasMultipleLoops(const std::vector<he::edge3*>& seam)
 }
 
 void OnVertexInvalid(he::DoublyLinkedList<he::vert3>& verts,
-    he::DoublyLinkedList<he::edge3>& edges, he::DoublyLinkedList<he::loop3>& loops);
+    he::DoublyLinkedList<he::edge3>& edges, he::DoublyLinkedList<he::loop3>& loops, he::EditLog* log);
 
 void OnEdgeInvalid(he::DoublyLinkedList<he::vert3>& verts,
                    he::DoublyLinkedList<he::edge3>& edges,
-                   he::DoublyLinkedList<he::loop3>& loops)
+                   he::DoublyLinkedList<he::loop3>& loops,
+                   he::EditLog* log)
 {
     bool edge_dirty = false;
 
@@ -387,6 +477,7 @@ void OnEdgeInvalid(he::DoublyLinkedList<he::vert3>& verts,
             auto first_edge = curr_edge;
             do {
                 if (!curr_edge->ids.IsValid()) {
+                    touch(log, curr_l);
                     curr_l->ids.MakeInvalid();
                     break;
                 }
@@ -399,6 +490,7 @@ void OnEdgeInvalid(he::DoublyLinkedList<he::vert3>& verts,
                 auto first_edge = curr_edge;
                 do {
                     if (curr_edge->ids.IsValid()) {
+                        touch(log, curr_edge);
                         curr_edge->ids.MakeInvalid();
                         edge_dirty = true;
                     }
@@ -411,13 +503,14 @@ void OnEdgeInvalid(he::DoublyLinkedList<he::vert3>& verts,
     } while (curr_l != first_l);
 
     if (edge_dirty) {
-        OnEdgeInvalid(verts, edges, loops);
+        OnEdgeInvalid(verts, edges, loops, log);
     }
 }
 
 void OnVertexInvalid(he::DoublyLinkedList<he::vert3>& verts,
                      he::DoublyLinkedList<he::edge3>& edges,
-                     he::DoublyLinkedList<he::loop3>& loops)
+                     he::DoublyLinkedList<he::loop3>& loops,
+                     he::EditLog* log)
 {
     bool edge_dirty = false;
 
@@ -425,6 +518,7 @@ void OnVertexInvalid(he::DoublyLinkedList<he::vert3>& verts,
     auto first_edge = curr_edge;
     do {
         if (curr_edge->ids.IsValid() && !curr_edge->vert->ids.IsValid()) {
+            touch(log, curr_edge);
             curr_edge->ids.MakeInvalid();
             edge_dirty = true;
         }
@@ -433,62 +527,44 @@ void OnVertexInvalid(he::DoublyLinkedList<he::vert3>& verts,
     } while (curr_edge != first_edge);
 
     if (edge_dirty) {
-        OnEdgeInvalid(verts, edges, loops);
+        OnEdgeInvalid(verts, edges, loops, log);
     }
 }
 
-bool FixVertexInvalid(he::DoublyLinkedList<he::vert3>& verts,
-                      he::DoublyLinkedList<he::edge3>& edges)
+bool FixVertexInvalid(he::DoublyLinkedList<he::vert3>& verts, he::EditLog* log)
 {
     bool vert_dirty = false;
 
-    // map vertex to edges
-    std::map<he::vert3*, std::vector<he::edge3*>> vert2edges;
-    auto curr_edge = edges.Head();
-    auto first_edge = curr_edge;
-    do {
-        auto itr = vert2edges.find(curr_edge->vert);
-        if (itr != vert2edges.end()) {
-            itr->second.push_back(curr_edge);
-        } else {
-            vert2edges.insert({ curr_edge->vert, { curr_edge } });
-        }
-
-        curr_edge = curr_edge->linked_next;
-    } while (curr_edge != first_edge);
-
-    // fix verts
-    auto first_vert = verts.Head();
-    auto curr_vert = first_vert;
-    do {
-        if (!curr_vert->ids.IsValid() ||
-            curr_vert->ids.IsValid() && curr_vert->edge->ids.IsValid()) {
-            curr_vert = curr_vert->linked_next;
+    // the invalid edges are still linked, walk the fan for a valid one,
+    // only v->edge's fan is seen, the verts are taken as manifold: a soup vert
+    // shared by several fans is made invalid with the valid edges of the others
+    for (auto v : verts)
+    {
+        if (!v->ids.IsValid() || v->edge->ids.IsValid()) {
             continue;
         }
 
-        auto itr = vert2edges.find(curr_vert);
-        assert(itr != vert2edges.end());
-        bool find = false;
-        for (auto& e : itr->second) {
+        he::edge3* valid = nullptr;
+        for (auto e : he::out_edges(*v)) {
             if (e->ids.IsValid()) {
-                curr_vert->edge = e;
-                find = true;
+                valid = e;
                 break;
             }
         }
-        if (!find) {
-            curr_vert->ids.MakeInvalid();
+
+        touch(log, v);
+        if (valid) {
+            v->edge = valid;
+        } else {
+            v->ids.MakeInvalid();
             vert_dirty = true;
         }
-
-        curr_vert = curr_vert->linked_next;
-    } while (curr_vert != first_vert);
+    }
 
     return vert_dirty;
 }
 
-void FixEdgeInvalid(he::DoublyLinkedList<he::edge3>& edges)
+void FixEdgeInvalid(he::DoublyLinkedList<he::edge3>& edges, he::EditLog* log)
 {
     auto first_edge = edges.Head();
     auto curr_edge = first_edge;
@@ -500,6 +576,8 @@ void FixEdgeInvalid(he::DoublyLinkedList<he::edge3>& edges)
             assert(curr_edge->prev->ids.IsValid());
             assert(curr_edge->next->ids.IsValid());
             if (curr_edge->twin && !curr_edge->twin->ids.IsValid()) {
+                touch(log, curr_edge);
+                touch(log, curr_edge->twin);
                 edge_del_pair(curr_edge);
             }
         }
@@ -508,7 +586,7 @@ void FixEdgeInvalid(he::DoublyLinkedList<he::edge3>& edges)
     } while (curr_edge != first_edge);
 }
 
-void FixLoopInvalid(he::DoublyLinkedList<he::loop3>& loops)
+void FixLoopInvalid(he::DoublyLinkedList<he::loop3>& loops, he::EditLog* log)
 {
     auto first_l = loops.Head();
     auto curr_l = first_l;
@@ -519,6 +597,7 @@ void FixLoopInvalid(he::DoublyLinkedList<he::loop3>& loops)
             auto curr_edge = first_edge;
             do {
                 if (curr_edge->ids.IsValid()) {
+                    touch(log, curr_l);
                     curr_l->edge = curr_edge;
                     break;
                 }
@@ -555,7 +634,7 @@ bool IsLoopValid(const he::loop3* loop)
     return true;
 }
 
-void DeleteInvalid(std::vector<he::Polyhedron::Face>& faces)
+void DeleteInvalid(std::vector<he::Polyhedron::Face>& faces, he::EditLog* log)
 {
     for (auto itr = faces.begin(); itr != faces.end(); )
     {
@@ -571,7 +650,11 @@ void DeleteInvalid(std::vector<he::Polyhedron::Face>& faces)
         }
 
         if (!valid) {
+            touch(log, itr->border);
             itr->border->type = he::EditType::Del;
+            if (log) {
+                log->EraseFace(std::distance(faces.begin(), itr), *itr);
+            }
             itr = faces.erase(itr);
         } else {
             itr++;
@@ -579,8 +662,8 @@ void DeleteInvalid(std::vector<he::Polyhedron::Face>& faces)
     }
 }
 
-template <typename T>
-void DeleteInvalid(he::DoublyLinkedList<T>& list)
+template <typename T, typename Func>
+void DeleteInvalid(he::DoublyLinkedList<T>& list, he::EditLog* log, Func on_delete)
 {
     std::vector<T*> invalid;
     auto first = list.Head();
@@ -593,18 +676,27 @@ void DeleteInvalid(he::DoublyLinkedList<T>& list)
     } while (curr != first);
 
     for (auto& i : invalid) {
-        list.Remove(i);
+        on_delete(*i);
+        list_remove(log, list, i);
     }
     for (auto& i : invalid) {
-        delete i;
+        delete_elem(log, i);
     }
 }
 
-void DeleteByPlane(const sm::Plane& plane, bool del_above,
+template <typename T>
+void DeleteInvalid(he::DoublyLinkedList<T>& list, he::EditLog* log)
+{
+    DeleteInvalid(list, log, [](const T&) {});
+}
+
+// return true if a deleted vert was on the aabb
+bool DeleteByPlane(const sm::Plane& plane, bool del_above,
                    he::DoublyLinkedList<he::vert3>& verts,
                    he::DoublyLinkedList<he::edge3>& edges,
                    he::DoublyLinkedList<he::loop3>& loops,
-                   std::vector<he::Polyhedron::Face>& faces)
+                   std::vector<he::Polyhedron::Face>& faces,
+                   const sm::cube& aabb, he::EditLog* log)
 {
     bool vert_dirty = false;
 
@@ -614,6 +706,7 @@ void DeleteByPlane(const sm::Plane& plane, bool del_above,
         auto st = he::Utility::CalcPointPlaneStatus(plane, curr_vert->position);
         if ((st == PointStatus::Above && del_above) ||
             (st == PointStatus::Below && !del_above)) {
+            touch(log, curr_vert);
             curr_vert->ids.MakeInvalid();
             vert_dirty = true;
         }
@@ -622,22 +715,29 @@ void DeleteByPlane(const sm::Plane& plane, bool del_above,
     } while (curr_vert != first_vert);
 
     if (!vert_dirty) {
-        return;
+        return false;
     }
 
     do {
-        OnVertexInvalid(verts, edges, loops);
-    } while (FixVertexInvalid(verts, edges));
-    FixEdgeInvalid(edges);
-    FixLoopInvalid(loops);
+        OnVertexInvalid(verts, edges, loops, log);
+    } while (FixVertexInvalid(verts, log));
+    FixEdgeInvalid(edges, log);
+    FixLoopInvalid(loops, log);
 
-    DeleteInvalid(faces);
+    DeleteInvalid(faces, log);
 
-    DeleteInvalid(verts);
-    DeleteInvalid(edges);
-    DeleteInvalid(loops);
+    bool on_aabb = false;
+    DeleteInvalid(verts, log, [&](const he::vert3& v) {
+        if (!on_aabb && he::Utility::IsPointOnAABB(aabb, v.position)) {
+            on_aabb = true;
+        }
+    });
+    DeleteInvalid(edges, log);
+    DeleteInvalid(loops, log);
+
+    DeleteInvalid(faces, log);
 
-    DeleteInvalid(faces);
+    return on_aabb;
 }
 
 int GetNoTwinEdgesNum(const he::DoublyLinkedList<he::edge3>& edges)
@@ -656,22 +756,6 @@ int GetNoTwinEdgesNum(const he::DoublyLinkedList<he::edge3>& edges)
     return ret;
 }
 
-sm::cube CalcAABB(const he::DoublyLinkedList<he::vert3>& verts)
-{
-    if (verts.Size() == 0) {
-        return sm::cube();
-    }
-
-    sm::cube aabb;
-    auto first_vertex = verts.Head();
-    auto curr_vertex = first_vertex;
-    do {
-        aabb.Combine(curr_vertex->position);
-        curr_vertex = curr_vertex->linked_next;
-    } while (curr_vertex != first_vertex);
-    return aabb;
-}
-
 void fix_seam_order(std::vector<he::edge3*>& seam, const sm::Plane& plane, he::Polyhedron::KeepType keep)
 {
     std::vector<sm::vec3> loop;
@@ -699,190 +783,164 @@ void fix_seam_order(std::vector<he::edge3*>& seam, const sm::Plane& plane, he::P
     }
 }
 
-void rm_face(he::loop3* loop, std::vector<he::Polyhedron::Face>& faces)
+void flood_fill(he::edge3* seed, std::vector<he::edge3*>& buf)
 {
-    for (auto itr = faces.begin(); itr != faces.end(); ++itr)
+    buf.clear();
+    buf.push_back(seed);
+    seed->mark = 1;
+    while (!buf.empty())
     {
-        if (itr->border == loop) {
-            faces.erase(itr);
-            break;
-        }
-    }
-}
-
-void sew_seam(const he::loop3* cover, const he::loop3* cover2,  
-              he::DoublyLinkedList<he::loop3>& loops,
-              he::DoublyLinkedList<he::edge3>& edges,
-              he::DoublyLinkedList<he::vert3>& verts,
-              std::vector<he::Polyhedron::Face>& faces)
-{
-    std::vector<he::edge3*> edges0, edges1;
+        auto e = buf.back();
+        buf.pop_back();
 
-    auto curr_edge = cover->edge;
-    auto first_edge = curr_edge;
-    do {
-        edges0.push_back(curr_edge);
-        curr_edge = curr_edge->next;
-    } while (curr_edge != first_edge);
+        e->vert->mark = 1;
+        e->loop->mark = 1;
 
-    curr_edge = cover2->edge;
-    first_edge = curr_edge;
-    do {
-        edges1.push_back(curr_edge);
-        curr_edge = curr_edge->next;
-    } while (curr_edge != first_edge);
-
-    std::vector<he::edge3*> del_edges;
-
-    assert(edges0.size() == edges1.size());
-    for (int i = 0, n = edges0.size(); i < n; ++i)
-    {
-        // n1    p1
-        // ^     |
-        // |     |
-        // |     V
-        // <-----o
-        // 
-        // o----->
-        // ^     |
-        // |     |
-        // |     V
-        // p0    n0
-        auto p0 = edges0[i]->twin->prev->vert->position;
-        auto n0 = edges0[i]->twin->next->vert->position;
-        auto p1 = edges1[i]->twin->prev->vert->position;
-        auto n1 = edges1[i]->twin->next->vert->position;
-
-        edges0[i]->twin->next->vert->position = edges1[i]->twin->prev->vert->position;
-        assert(edges1[i]->twin->prev->prev->twin->vert == edges1[i]->twin->prev->vert);
-        edges1[i]->twin->prev->prev->twin->vert = edges0[i]->twin->next->vert;
-        assert(edges1[i]->twin->prev->twin->next->vert == edges1[i]->twin->prev->vert);
-        edges1[i]->twin->prev->twin->next->vert = edges0[i]->twin->next->vert;
-
-        del_edges.push_back(edges1[i]->twin->prev);
-        del_edges.push_back(edges1[i]->twin->next);
-
-        edges0[i]->twin->prev->Connect(edges1[i]->twin->next->next);
-        edges1[i]->twin->prev->prev->Connect(edges0[i]->twin->next);
-
-        verts.Remove(edges1[i]->twin->prev->vert);
-        verts.Remove(edges1[i]->twin->next->vert);
-
-        rm_face(edges1[i]->twin->loop, faces);
-
-        loops.Remove(edges1[i]->twin->loop);
-        delete edges1[i]->twin->loop;
-    }
-
-    for (auto e : del_edges) {
-        edges.Remove(e);
-        delete e;
+        he::edge3* adj[] = { e->next, e->prev, e->twin };
+        for (auto n : adj) {
+            if (n && !n->mark) {
+                n->mark = 1;
+                buf.push_back(n);
+            }
+        }
     }
 }
 
-void rm_loop(he::loop3* loop, he::DoublyLinkedList<he::loop3>& loops, 
-             he::DoublyLinkedList<he::edge3>& edges,
-             std::vector<he::Polyhedron::Face>& faces)
-{
-    rm_face(loop, faces);
-
-    auto curr_edge = loop->edge;
-    auto first_edge = curr_edge;
-    do {
-        assert(curr_edge->twin->twin == curr_edge);
-        curr_edge->twin->twin = nullptr;
-
-        edges.Remove(curr_edge->twin);
-        delete curr_edge->twin;
-
-        edges.Remove(curr_edge);
-        auto next_edge = curr_edge->next;
-        delete curr_edge;
-
-        curr_edge = next_edge;
-    } while (curr_edge != first_edge);
-
-    loops.Remove(loop);
-    delete loop;
-}
-
 void separate(he::Polyhedron* poly, const sm::Plane& plane, 
               he::DoublyLinkedList<he::vert3>& new_verts,
               he::DoublyLinkedList<he::edge3>& new_edges,
               he::DoublyLinkedList<he::loop3>& new_loops,
               std::vector<he::Polyhedron::Face>& new_faces)
 {
-    std::set<he::vert3*> verts_up;
+    // mark the components which have vertex above the plane,
+    // the seam covers have already cut the twins between two sides
+    std::vector<he::edge3*> buf;
     he::edge3* first = poly->GetEdges().Head();
     he::edge3* e = first;
     do {
-        auto os = he::Utility::CalcPointPlaneStatus(plane, e->vert->position);
-        switch (os)
-        {
-        case PointStatus::Above:
-            verts_up.insert(e->vert);
-            break;
-        case PointStatus::Inside:
-            if (he::Utility::CalcPointPlaneStatus(plane, e->next->vert->position) == PointStatus::Above) {
-                verts_up.insert(e->vert);
-            }
-            break;
+        if (!e->mark && he::Utility::CalcPointPlaneStatus(plane, e->vert->position) == PointStatus::Above) {
+            flood_fill(e, buf);
         }
-
         e = e->linked_next;
     } while (e != first);
 
-    auto& ori_verts = const_cast<he::DoublyLinkedList<he::vert3>&>(poly->GetVerts());
-    he::vert3* v = ori_verts.Head();
-    for (int i = 0, n = ori_verts.Size(); i < n; ++i)
-    {
-        if (verts_up.find(v) != verts_up.end()) {
-            v = v->linked_next;
-        } else {
-            auto next = ori_verts.Remove(v);
-            new_verts.Append(v);
-            v = next;
-        }
+    auto& ori_faces = const_cast<std::vector<he::Polyhedron::Face>&>(poly->GetFaces());
+    auto itr = std::stable_partition(ori_faces.begin(), ori_faces.end(), 
+        [](const he::Polyhedron::Face& f) { return f.border->mark != 0; });
+    std::move(itr, ori_faces.end(), std::back_inserter(new_faces));
+    ori_faces.erase(itr, ori_faces.end());
+
+    // keep the marked and clear the marks
+    auto is_up = [](auto* item) -> bool {
+        const bool up = item->mark != 0;
+        item->mark = 0;
+        return up;
+    };
+    const_cast<he::DoublyLinkedList<he::vert3>&>(poly->GetVerts()).Partition(is_up, new_verts);
+    const_cast<he::DoublyLinkedList<he::edge3>&>(poly->GetEdges()).Partition(is_up, new_edges);
+    const_cast<he::DoublyLinkedList<he::loop3>&>(poly->GetLoops()).Partition(is_up, new_loops);
+}
+
+
+sm::vec3 calc_loop_center(const he::loop3& loop)
+{
+    sm::vec3 center;
+    size_t num = 0;
+
+    auto first_e = loop.edge;
+    auto curr_e = first_e;
+    do {
+        center += curr_e->vert->position;
+        ++num;
+        curr_e = curr_e->next;
+    } while (curr_e != first_e);
+
+    return center / static_cast<float>(num);
+}
+
+// same positions in opposite order, as the two seam covers made by Fork
+bool is_loop_coincident(const he::loop3& l0, const he::loop3& l1, float distance)
+{
+    if (he::Utility::EdgeSize(l0) != he::Utility::EdgeSize(l1)) {
+        return false;
     }
 
-    auto& ori_edges = const_cast<he::DoublyLinkedList<he::edge3>&>(poly->GetEdges());
-    e = ori_edges.Head();
-    for (int i = 0, n = ori_edges.Size(); i < n; ++i)
+    auto& start_pos = l0.edge->vert->position;
+    auto start = l1.edge;
+    while (sm::dis_pos3_to_pos3(start->vert->position, start_pos) >= distance)
     {
-        if (verts_up.find(e->vert) != verts_up.end()) {
-            e = e->linked_next;
-        } else {
-            auto next = ori_edges.Remove(e);
-            new_edges.Append(e);
-            e = next;
+        start = start->next;
+        if (start == l1.edge) {
+            return false;
         }
     }
 
-    auto& ori_loops = const_cast<he::DoublyLinkedList<he::loop3>&>(poly->GetLoops());
-    auto l = ori_loops.Head();
-    for (int i = 0, n = ori_loops.Size(); i < n; ++i)
-    {
-        if (verts_up.find(l->edge->vert) != verts_up.end()) {
-            l = l->linked_next;
-        } else {
-            auto next = ori_loops.Remove(l);
-            new_loops.Append(l);
-            l = next;
+    auto e0 = l0.edge;
+    auto e1 = start;
+    do {
+        if (sm::dis_pos3_to_pos3(e0->vert->position, e1->vert->position) >= distance) {
+            return false;
         }
-    }
+        e0 = e0->next;
+        e1 = e1->prev;
+    } while (e0 != l0.edge);
 
-    auto& ori_faces = const_cast<std::vector<he::Polyhedron::Face>&>(poly->GetFaces());
-    for (auto itr = ori_faces.begin(); itr != ori_faces.end(); )
-    {
-        if (verts_up.find(itr->border->edge->vert) != verts_up.end()) {
-            ++itr;
-        } else {
-            new_faces.push_back(*itr);
-            itr = ori_faces.erase(itr);
+    return true;
+}
+
+// remove the loop's edges, their twins become boundary
+void rm_cover(he::loop3* loop, he::DoublyLinkedList<he::edge3>& edges, he::DoublyLinkedList<he::loop3>& loops)
+{
+    std::vector<he::edge3*> del_edges;
+
+    auto first_e = loop->edge;
+    auto curr_e = first_e;
+    do {
+        del_edges.push_back(curr_e);
+        curr_e = curr_e->next;
+    } while (curr_e != first_e);
+
+    for (auto& e : del_edges) {
+        if (e->vert->edge == e) {
+            e->vert->edge = e->prev->twin;
+            assert(e->vert->edge);
         }
     }
+    for (auto& e : del_edges) {
+        edge_del_pair(e);
+        edges.Remove(e);
+        delete e;
+    }
+
+    loop->mark = 1;
+    loops.Remove(loop);
 }
 
+void rm_marked_faces(std::vector<he::Polyhedron::Face>& faces)
+{
+    auto is_marked = [](const he::loop3* l) { return l->mark != 0; };
+    for (auto& f : faces) {
+        f.holes.erase(std::remove_if(f.holes.begin(), f.holes.end(), is_marked), f.holes.end());
+    }
+    faces.erase(std::remove_if(faces.begin(), faces.end(), [&](const he::Polyhedron::Face& f) {
+        return is_marked(f.border);
+    }), faces.end());
+}
+
+// point all the half-edges emanating from the fan to vert,
+// step is prev->twin from an outgoing boundary edge, twin->next from an incoming one
+void retarget_fan(he::edge3* edge, he::vert3* vert, bool walk_prev)
+{
+    auto curr_e = edge;
+    do {
+        curr_e->vert = vert;
+        if (walk_prev) {
+            curr_e = curr_e->prev->twin;
+        } else {
+            curr_e = curr_e->twin ? curr_e->twin->next : nullptr;
+        }
+    } while (curr_e && curr_e != edge);
+}
 }
 
 namespace he
@@ -904,7 +962,7 @@ bool Polyhedron::Clip(const sm::Plane& plane, KeepType keep, bool seam_face)
     }
 
     auto seam = IntersectWithPlane(plane, m_verts, m_edges, m_loops,
-        m_next_vert_id, m_next_edge_id, m_next_loop_id, m_faces);
+        m_next_vert_id, m_next_edge_id, m_next_loop_id, m_faces, m_log);
     if (seam.empty()) {
         return false;
     }
@@ -915,22 +973,27 @@ bool Polyhedron::Clip(const sm::Plane& plane, KeepType keep, bool seam_face)
 
 //        assert(!seam.front()->twin);
 
+        auto log = m_log;
+
         auto new_loop = new loop3(m_next_loop_id++);
         new_loop->type = EditType::Add;
-        m_loops.Append(new_loop);
-        m_faces.emplace_back(new_loop);
+        list_append(log, m_loops, new_loop);
+        append_face(log, m_faces, new_loop);
 
         std::vector<edge3*> new_edges;
         new_edges.reserve(seam.size());
         for (int i = 0, n = seam.size(); i < n; ++i)
         {
+            touch(log, seam[(i + 1) % n]->vert);
             edge3* new_edge = new edge3(seam[(i + 1) % n]->vert, new_loop, m_next_edge_id++);
             new_edge->type = EditType::Add;
 
+            touch(log, seam[i]);
+            touch(log, seam[i]->twin);
             edge_del_pair(seam[i]);
             edge_make_pair(new_edge, seam[i]);
             new_edges.push_back(new_edge);
-            m_edges.Append(new_edge);
+            list_append(log, m_edges, new_edge);
         }
 
         if (new_edges.size() > 1) {
@@ -942,23 +1005,64 @@ bool Polyhedron::Clip(const sm::Plane& plane, KeepType keep, bool seam_face)
         new_loop->edge = new_edges[0];
     }
 
+    // the seam verts are on the edges, inside the box
     if (keep != KeepType::KeepAll) {
-        DeleteByPlane(plane, keep == KeepType::KeepBelow, m_verts, m_edges, m_loops, m_faces);
+        if (DeleteByPlane(plane, keep == KeepType::KeepBelow, m_verts, m_edges, m_loops, m_faces, m_aabb, m_log)) {
+            SetAABBDirty();
+        }
     }
 
     assert(GetNoTwinEdgesNum(m_edges) == 0);
 
-    m_aabb = CalcAABB(m_verts);
+    m_hash = 0;
 
     return true;
 }
 
+std::vector<PolyhedronPtr> Polyhedron::Clip(const std::vector<PolyhedronPtr>& polys,
+                                            const sm::Plane& plane, KeepType keep, bool seam_face)
+{
+    std::vector<uint8_t> kept(polys.size(), 0);
+
+    std::vector<size_t> cross;
+    for (size_t i = 0, n = polys.size(); i < n; ++i)
+    {
+        switch (Utility::CalcAABBPlaneStatus(polys[i]->GetAABB(), plane))
+        {
+        case PointStatus::Above:
+            kept[i] = keep != KeepType::KeepBelow;
+            break;
+        case PointStatus::Below:
+            kept[i] = keep != KeepType::KeepAbove;
+            break;
+        default:
+            // crossing or flat in the plane, left to Clip
+            cross.push_back(i);
+        }
+    }
+
+    // each task only edits its own poly, ids are per poly
+    Utility::ParallelFor(cross.size(), [&](size_t i) {
+        kept[cross[i]] = polys[cross[i]]->Clip(plane, keep, seam_face);
+    });
+
+    std::vector<PolyhedronPtr> ret;
+    for (size_t i = 0, n = polys.size(); i < n; ++i) {
+        if (kept[i]) {
+            ret.push_back(polys[i]);
+        }
+    }
+    return ret;
+}
+
 std::shared_ptr<Polyhedron> Polyhedron::Fork(const sm::Plane& plane)
 {
+    assert(!m_log);
+
     auto seam = IntersectWithPlane(plane, m_verts, m_edges, m_loops,
-        m_next_vert_id, m_next_edge_id, m_next_loop_id, m_faces);
+        m_next_vert_id, m_next_edge_id, m_next_loop_id, m_faces, nullptr);
     if (seam.empty()) {
-        return false;
+        return nullptr;
     }
 
     // clone middle pos
@@ -1002,10 +1106,12 @@ std::shared_ptr<Polyhedron> Polyhedron::Fork(const sm::Plane& plane)
         return new_loop;
     };
 
+    // twins run backward along the seam
     std::vector<edge3*> twin_seam;
     for (auto& edge : seam) {
         twin_seam.push_back(edge->twin);
     }
+    std::reverse(twin_seam.begin(), twin_seam.end());
 
     auto cover = seam2face(seam);
     auto cover2 = seam2face(twin_seam);
@@ -1013,18 +1119,138 @@ std::shared_ptr<Polyhedron> Polyhedron::Fork(const sm::Plane& plane)
     //out_seam.push_back(cover2);
 
     auto ret = std::make_shared<Polyhedron>();
+    ret->m_next_vert_id = m_next_vert_id;
+    ret->m_next_edge_id = m_next_edge_id;
+    ret->m_next_loop_id = m_next_loop_id;
     separate(this, plane, ret->m_verts, ret->m_edges, ret->m_loops, ret->m_faces);
-    UpdateAABB();
-    ret->UpdateAABB();
+
+    // both sides lose verts, the boxes are recomputed when queried
+    m_hash = 0;
+    SetAABBDirty();
+    ret->SetAABBDirty();
 
     return ret;
 }
 
 bool Polyhedron::Join(const std::shared_ptr<Polyhedron>& poly)
 {
-    // todo: check seams valid
-    auto seam0 = m_loops.Head()->linked_prev;
-    auto seam1 = poly->GetLoops().Head()->linked_prev;
+    return Join(poly, Utility::POINT_STATUS_EPSILON);
+}
+
+bool Polyhedron::Join(const std::shared_ptr<Polyhedron>& poly, float distance)
+{
+    assert(!m_log);
+
+    // remove the coincident covers
+    if (distance > 0 && m_loops.Size() > 0 && poly->m_loops.Size() > 0)
+    {
+        SpatialHash<loop3*> covers(distance);
+        auto first_l = poly->m_loops.Head();
+        auto curr_l = first_l;
+        do {
+            covers.Insert(calc_loop_center(*curr_l), curr_l);
+            curr_l = curr_l->linked_next;
+        } while (curr_l != first_l);
+
+        std::vector<std::pair<loop3*, loop3*>> pairs;
+        first_l = m_loops.Head();
+        curr_l = first_l;
+        do {
+            covers.Query(calc_loop_center(*curr_l), distance, [&](const sm::vec3&, loop3* l) -> bool
+            {
+                if (l->mark || !is_loop_coincident(*curr_l, *l, distance)) {
+                    return false;
+                }
+                l->mark = 1;
+                pairs.push_back({ curr_l, l });
+                return true;
+            });
+            curr_l = curr_l->linked_next;
+        } while (curr_l != first_l);
+
+        for (auto& pair : pairs) {
+            rm_cover(pair.first, m_edges, m_loops);
+            rm_cover(pair.second, poly->m_edges, poly->m_loops);
+        }
+        rm_marked_faces(m_faces);
+        rm_marked_faces(poly->m_faces);
+        for (auto& pair : pairs) {
+            delete pair.first;
+            delete pair.second;
+        }
+    }
+
+    // match boundary edges, a: u -> v with b: v -> u
+    std::vector<std::pair<edge3*, edge3*>> seams;
+    if (distance > 0 && m_edges.Size() > 0 && poly->m_edges.Size() > 0)
+    {
+        SpatialHash<edge3*> boundary(distance);
+        auto first_e = poly->m_edges.Head();
+        auto curr_e = first_e;
+        do {
+            if (!curr_e->twin) {
+                boundary.Insert(curr_e->vert->position, curr_e);
+            }
+            curr_e = curr_e->linked_next;
+        } while (curr_e != first_e);
+
+        first_e = m_edges.Head();
+        curr_e = first_e;
+        do {
+            if (!curr_e->twin)
+            {
+                auto& end_pos = curr_e->vert->position;
+                boundary.Query(curr_e->next->vert->position, distance, [&](const sm::vec3&, edge3* e) -> bool
+                {
+                    if (e->mark || sm::dis_pos3_to_pos3(e->next->vert->position, end_pos) >= distance) {
+                        return false;
+                    }
+                    e->mark = 1;
+                    seams.push_back({ curr_e, e });
+                    return true;
+                });
+            }
+            curr_e = curr_e->linked_next;
+        } while (curr_e != first_e);
+    }
+
+    // weld poly's seam verts, before the twins close the fans
+    std::vector<vert3*> del_verts;
+    for (auto& seam : seams)
+    {
+        auto b = seam.second;
+        b->mark = 0;
+        for (auto v : { b->vert, b->next->vert }) {
+            if (v->mark == 0) {
+                v->mark = 1;
+                del_verts.push_back(v);
+            }
+        }
+    }
+    for (auto& seam : seams) {
+        retarget_fan(seam.second, seam.first->next->vert, true);
+        retarget_fan(seam.second->next, seam.first->vert, false);
+    }
+    for (auto& v : del_verts) {
+        poly->ShrinkAABB(v->position);
+        poly->m_verts.Remove(v);
+        delete v;
+    }
+    for (auto& seam : seams) {
+        edge_make_pair(seam.first, seam.second);
+    }
+
+    CombineAABB(poly->GetAABB());
+    m_hash = 0;
+
+    // ids are counted per poly, move poly's after ours
+    if (poly->m_verts.Size() > 0 && poly->m_edges.Size() > 0 && poly->m_loops.Size() > 0)
+    {
+        poly->OffsetTopoID(m_next_vert_id, m_next_edge_id, m_next_loop_id);
+        m_next_vert_id = poly->m_next_vert_id;
+        m_next_edge_id = poly->m_next_edge_id;
+        m_next_loop_id = poly->m_next_loop_id;
+    }
 
     m_verts.Connect(poly->m_verts);
     m_edges.Connect(poly->m_edges);
@@ -1033,27 +1259,10 @@ bool Polyhedron::Join(const std::shared_ptr<Polyhedron>& poly)
     std::copy(poly->m_faces.begin(), poly->m_faces.end(), std::back_inserter(m_faces));
     poly->m_faces.clear();
 
-    sew_seam(seam0, seam1, m_loops, m_edges, m_verts, m_faces);
-    rm_loop(seam0, m_loops, m_edges, m_faces);
-    rm_loop(seam1, m_loops, m_edges, m_faces);
-
-    //// offset
-    //std::set<he::vert3*> verts_up;
-    //he::edge3* first = m_edges.Head();
-    //he::edge3* e = first;
-    //do {
-    //    if (e->vert->position.y > 0) {
-    //        verts_up.insert(e->vert);
-    //    } else if (e->vert->position.y == 0 && e->next && e->next->vert->position.y > 0) {
-    //        verts_up.insert(e->vert);
-    //    }
-    //    e = e->linked_next;
-    //} while (e != first);
-    //for (auto v : verts_up) {
-    //    v->position.x += 2.0f;
-    //}
+    poly->SetAABBDirty();
+    poly->m_hash = 0;
 
-    return true;
+    return !seams.empty();
 }
 
 }
\ No newline at end of file
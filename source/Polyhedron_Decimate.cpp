@@ -0,0 +1,588 @@
+#include "halfedge/Polyhedron.h"
+#include "halfedge/Utility.h"
+#include "halfedge/CancelToken.h"
+#include "halfedge/EditLog.h"
+#include "halfedge/Circulator.h"
+
+#include <SM_Plane.h>
+
+#include <queue>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+namespace
+{
+
+// symmetric 4x4, the upper triangle row by row
+struct Quadric
+{
+    double m[10] = { 0 };
+
+    void AddPlane(const sm::Plane& plane)
+    {
+        const double p[4] = { plane.normal.x, plane.normal.y, plane.normal.z, plane.dist };
+        int k = 0;
+        for (int i = 0; i < 4; ++i) {
+            for (int j = i; j < 4; ++j) {
+                m[k++] += p[i] * p[j];
+            }
+        }
+    }
+
+    Quadric operator + (const Quadric& q) const
+    {
+        Quadric ret;
+        for (int i = 0; i < 10; ++i) {
+            ret.m[i] = m[i] + q.m[i];
+        }
+        return ret;
+    }
+
+    double Eval(const sm::vec3& pos) const
+    {
+        const double x = pos.x, y = pos.y, z = pos.z;
+        return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+             + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+             + m[7] * z * z + 2 * m[8] * z
+             + m[9];
+    }
+
+    // the minimum, false if the 3x3 part is singular
+    bool Solve(sm::vec3& pos) const
+    {
+        const double a00 = m[0], a01 = m[1], a02 = m[2];
+        const double a11 = m[4], a12 = m[5];
+        const double a22 = m[7];
+        const double b0 = -m[3], b1 = -m[6], b2 = -m[8];
+
+        const double c00 = a11 * a22 - a12 * a12;
+        const double c01 = a02 * a12 - a01 * a22;
+        const double c02 = a01 * a12 - a02 * a11;
+        const double det = a00 * c00 + a01 * c01 + a02 * c02;
+        if (std::abs(det) < 1e-12) {
+            return false;
+        }
+
+        const double c11 = a00 * a22 - a02 * a02;
+        const double c12 = a01 * a02 - a00 * a12;
+        const double c22 = a00 * a11 - a01 * a01;
+        pos.x = static_cast<float>((c00 * b0 + c01 * b1 + c02 * b2) / det);
+        pos.y = static_cast<float>((c01 * b0 + c11 * b1 + c12 * b2) / det);
+        pos.z = static_cast<float>((c02 * b0 + c12 * b1 + c22 * b2) / det);
+        return true;
+    }
+
+}; // Quadric
+
+struct Collapse
+{
+    double cost;
+
+    // e->vert is merged into e->next->vert
+    he::edge3* edge;
+    // unique over all verts, the ends may be changed
+    size_t stamp0, stamp1;
+
+    sm::vec3 pos;
+
+    // the earlier pushed first for the same cost
+    size_t order;
+
+    bool operator < (const Collapse& c) const {
+        return cost > c.cost || (cost == c.cost && order > c.order);
+    }
+};
+
+// no corner turns back seen along normal, the merged verts are one at pos
+bool IsLoopConvex(const he::loop3& loop, const he::vert3* v0, const he::vert3* v1,
+                  const sm::vec3& pos, const sm::vec3& normal)
+{
+    std::vector<sm::vec3> pts;
+    bool last_merged = false;
+    auto first_e = loop.edge;
+    auto curr_e = first_e;
+    do {
+        auto v = curr_e->vert;
+        const bool merged = v == v0 || v == v1;
+        if (!merged) {
+            pts.push_back(v->position);
+        } else if (!last_merged) {
+            pts.push_back(pos);
+        }
+        last_merged = merged;
+        curr_e = curr_e->next;
+    } while (curr_e != first_e);
+    if (pts.size() > 1 && last_merged && (first_e->vert == v0 || first_e->vert == v1)) {
+        pts.pop_back();
+    }
+
+    for (size_t i = 0, n = pts.size(); i < n; ++i)
+    {
+        auto d0 = pts[i] - pts[(i + n - 1) % n];
+        auto d1 = pts[(i + 1) % n] - pts[i];
+        const float turn = d0.Cross(d1).Dot(normal);
+        const float eps = 1e-6f * d0.Length() * d1.Length();
+        if (turn < -eps || (turn <= eps && d0.Dot(d1) <= 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t CalcLoopSize(const he::loop3& loop)
+{
+    size_t ret = 0;
+    auto first_e = loop.edge;
+    auto curr_e = first_e;
+    do {
+        ++ret;
+        curr_e = curr_e->next;
+    } while (curr_e != first_e);
+    return ret;
+}
+
+class Decimator
+{
+public:
+    // log is null when no transaction
+    Decimator(he::Polyhedron& poly, he::EditLog* log)
+        : m_poly(poly)
+        , m_log(log)
+    {
+    }
+
+    ~Decimator()
+    {
+        for (auto& v : m_del_verts) {
+            delete v;
+        }
+        for (auto& e : m_del_edges) {
+            delete e;
+        }
+        for (auto& l : m_del_loops) {
+            delete l;
+        }
+    }
+
+    bool Run(size_t target_faces, float max_error, he::CancelToken* cancel)
+    {
+        Init();
+
+        size_t num_faces = m_poly.GetFaces().size();
+        while (num_faces > target_faces && num_faces > 4 && !m_queue.empty())
+        {
+            auto c = m_queue.top();
+            m_queue.pop();
+
+            if (!IsValid(c)) {
+                continue;
+            }
+            if (c.cost > max_error) {
+                break;
+            }
+            if (!CanCollapse(c.edge, c.pos)) {
+                continue;
+            }
+
+            if (cancel && !cancel->Check())
+            {
+                Finish();
+                return false;
+            }
+
+            num_faces -= Apply(c.edge, c.pos);
+        }
+
+        Finish();
+
+        return true;
+    }
+
+private:
+    void Init()
+    {
+        auto& verts = m_poly.GetVerts();
+        auto& edges = m_poly.GetEdges();
+        if (verts.Size() == 0) {
+            return;
+        }
+
+        m_vert2idx.reserve(verts.Size());
+        auto first_v = verts.Head();
+        auto curr_v = first_v;
+        do {
+            m_vert2idx.insert({ curr_v, m_vert2idx.size() });
+            curr_v = curr_v->linked_next;
+        } while (curr_v != first_v);
+
+        m_quadrics.resize(m_vert2idx.size());
+        m_stamps.resize(m_vert2idx.size());
+        for (size_t i = 0, n = m_stamps.size(); i < n; ++i) {
+            m_stamps[i] = m_next_stamp++;
+        }
+        m_locked.resize(m_vert2idx.size(), false);
+
+        // the faces with holes and the open edges are kept as they are
+        for (auto& face : m_poly.GetFaces())
+        {
+            sm::Plane plane;
+            he::Utility::LoopToPlane(*face.border, plane);
+
+            const bool lock = !face.holes.empty();
+            std::vector<he::loop3*> loops = { face.border };
+            std::copy(face.holes.begin(), face.holes.end(), std::back_inserter(loops));
+            for (auto& loop : loops)
+            {
+                auto first_e = loop->edge;
+                auto curr_e = first_e;
+                do {
+                    const size_t idx = m_vert2idx[curr_e->vert];
+                    m_quadrics[idx].AddPlane(plane);
+                    if (lock || !curr_e->twin) {
+                        m_locked[idx] = true;
+                        m_locked[m_vert2idx[curr_e->next->vert]] = true;
+                    }
+                    curr_e = curr_e->next;
+                } while (curr_e != first_e);
+            }
+        }
+
+        auto first_e = edges.Head();
+        auto curr_e = first_e;
+        do {
+            if (curr_e->twin && !curr_e->twin->mark) {
+                curr_e->mark = 1;
+                Push(curr_e);
+            }
+            curr_e = curr_e->linked_next;
+        } while (curr_e != first_e);
+
+        do {
+            curr_e->mark = 0;
+            curr_e = curr_e->linked_next;
+        } while (curr_e != first_e);
+    }
+
+    void Push(he::edge3* e)
+    {
+        const size_t i0 = m_vert2idx[e->vert];
+        const size_t i1 = m_vert2idx[e->next->vert];
+        if (m_locked[i0] || m_locked[i1]) {
+            return;
+        }
+
+        auto q = m_quadrics[i0] + m_quadrics[i1];
+
+        Collapse c;
+        c.edge = e;
+        c.stamp0 = m_stamps[i0];
+        c.stamp1 = m_stamps[i1];
+        if (q.Solve(c.pos))
+        {
+            c.cost = q.Eval(c.pos);
+        }
+        else
+        {
+            // the best of the ends and the midpoint
+            auto& p0 = e->vert->position;
+            auto& p1 = e->next->vert->position;
+            const sm::vec3 cands[3] = { p0, p1, (p0 + p1) * 0.5f };
+            c.cost = -1;
+            for (auto& p : cands)
+            {
+                const double cost = q.Eval(p);
+                if (c.cost < 0 || cost < c.cost) {
+                    c.cost = cost;
+                    c.pos = p;
+                }
+            }
+        }
+        c.cost = std::max(0.0, c.cost);
+
+        c.order = m_next_order++;
+        m_queue.push(c);
+    }
+
+    bool IsValid(const Collapse& c) const
+    {
+        auto e = c.edge;
+        if (e->mark) {
+            return false;
+        }
+        auto i0 = m_vert2idx.find(e->vert);
+        auto i1 = m_vert2idx.find(e->next->vert);
+        return m_stamps[i0->second] == c.stamp0
+            && m_stamps[i1->second] == c.stamp1;
+    }
+
+    // keep the mesh manifold and the faces unflipped
+    bool CanCollapse(he::edge3* e, const sm::vec3& pos) const
+    {
+        auto u = e->vert;
+        auto v = e->next->vert;
+        auto t = e->twin;
+
+        const bool tri_l = CalcLoopSize(*e->loop) == 3;
+        const bool tri_r = CalcLoopSize(*t->loop) == 3;
+        auto w_l = tri_l ? e->prev->vert : nullptr;
+        auto w_r = tri_r ? t->prev->vert : nullptr;
+        if (w_l && w_l == w_r) {
+            return false;
+        }
+        if (tri_l && e->next->twin->loop == e->prev->twin->loop) {
+            return false;
+        }
+        if (tri_r && t->next->twin->loop == t->prev->twin->loop) {
+            return false;
+        }
+
+        // the only shared neighbors are the tips of the triangles
+        std::unordered_set<he::vert3*> ring;
+        for (auto out : he::out_edges(*u)) {
+            ring.insert(out->next->vert);
+        }
+        for (auto out : he::out_edges(*v))
+        {
+            auto n = out->next->vert;
+            if (n != w_l && n != w_r && ring.find(n) != ring.end()) {
+                return false;
+            }
+        }
+
+        // no other loop has both, it would be pinched
+        for (auto out : he::out_edges(*u))
+        {
+            auto loop = out->loop;
+            if (loop == e->loop || loop == t->loop) {
+                continue;
+            }
+            for (auto le : he::loop_edges(*loop)) {
+                if (le->vert == v) {
+                    return false;
+                }
+            }
+        }
+
+        // fold over, the triangles on the edge are dropped,
+        // the convex loops stay convex and the others are not reshaped
+        for (auto vert : { u, v })
+        {
+            for (auto out : he::out_edges(*vert))
+            {
+                auto loop = out->loop;
+                if ((tri_l && loop == e->loop) || (tri_r && loop == t->loop)) {
+                    continue;
+                }
+                auto normal = he::Utility::CalcLoopNorm(*loop);
+                if (!IsLoopConvex(*loop, nullptr, nullptr, pos, normal) ||
+                    !IsLoopConvex(*loop, u, v, pos, normal)) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // return the number of faces removed
+    size_t Apply(he::edge3* e, const sm::vec3& pos)
+    {
+        auto u = e->vert;
+        auto v = e->next->vert;
+        auto t = e->twin;
+
+        // u's edges start from v, the walk only follows the links
+        for (auto out : he::out_edges(e)) {
+            Touch(out);
+            out->vert = v;
+        }
+
+        Touch(v);
+        v->position = pos;
+        v->edge = e->next;
+
+        const size_t iu = m_vert2idx[u];
+        const size_t iv = m_vert2idx[v];
+        m_quadrics[iv] = m_quadrics[iv] + m_quadrics[iu];
+        m_stamps[iu] = m_next_stamp++;
+        m_stamps[iv] = m_next_stamp++;
+
+        size_t removed = 0;
+        removed += RemoveEdge(e);
+        removed += RemoveEdge(t);
+
+        RemoveVert(u);
+
+        // the costs around v are changed
+        for (auto out : he::out_edges(*v)) {
+            Push(out);
+        }
+
+        return removed;
+    }
+
+    // take e off its loop, drop the loop once it is two edges
+    size_t RemoveEdge(he::edge3* e)
+    {
+        auto loop = e->loop;
+        Touch(loop);
+        if (loop->edge == e) {
+            loop->edge = e->next;
+        }
+        Touch(e->prev);
+        Touch(e->next);
+        e->prev->Connect(e->next);
+        Kill(e);
+
+        auto a = loop->edge;
+        auto b = a->next;
+        if (b->next != a) {
+            return 0;
+        }
+
+        // a: v -> w, b: w -> v, their twins are paired instead
+        auto ta = a->twin;
+        auto tb = b->twin;
+        Touch(a);
+        Touch(b);
+        Touch(ta);
+        Touch(tb);
+        Touch(ta->vert);
+        Touch(tb->vert);
+        edge_del_pair(a);
+        edge_del_pair(b);
+        edge_make_pair(ta, tb);
+        ta->vert->edge = ta;
+        tb->vert->edge = tb;
+
+        Kill(a);
+        Kill(b);
+
+        loop->mark = 1;
+        Remove(const_cast<he::DoublyLinkedList<he::loop3>&>(m_poly.GetLoops()), loop, m_del_loops);
+
+        return 1;
+    }
+
+    void Kill(he::edge3* e)
+    {
+        if (e->mark) {
+            return;
+        }
+        Touch(e);
+        e->mark = 1;
+        if (e->twin && e->twin->mark) {
+            Touch(e->twin);
+            edge_del_pair(e);
+        }
+        Remove(const_cast<he::DoublyLinkedList<he::edge3>&>(m_poly.GetEdges()), e, m_del_edges);
+    }
+
+    void RemoveVert(he::vert3* v)
+    {
+        Remove(const_cast<he::DoublyLinkedList<he::vert3>&>(m_poly.GetVerts()), v, m_del_verts);
+    }
+
+    void Finish()
+    {
+        // erased one by one for the log, at the index after the ones before
+        auto& faces = const_cast<std::vector<he::Polyhedron::Face>&>(m_poly.GetFaces());
+        size_t dst = 0;
+        for (size_t i = 0, n = faces.size(); i < n; ++i)
+        {
+            if (faces[i].border->mark != 0)
+            {
+                if (m_log) {
+                    m_log->EraseFace(dst, faces[i]);
+                }
+                continue;
+            }
+            if (dst != i) {
+                faces[dst] = faces[i];
+            }
+            ++dst;
+        }
+        faces.resize(dst);
+    }
+
+    template <typename T>
+    void Touch(T* item)
+    {
+        if (m_log) {
+            m_log->Touch(item);
+        }
+    }
+
+    // the delete is deferred to the log, else to the end
+    template <typename T>
+    void Remove(he::DoublyLinkedList<T>& list, T* item, std::vector<T*>& deleted)
+    {
+        Touch(item);
+        Touch(item->linked_prev);
+        Touch(item->linked_next);
+        list.Remove(item);
+
+        if (m_log) {
+            m_log->Delete(item);
+        } else {
+            deleted.push_back(item);
+        }
+    }
+
+private:
+    he::Polyhedron& m_poly;
+
+    he::EditLog* m_log;
+
+    std::unordered_map<he::vert3*, size_t> m_vert2idx;
+    std::vector<Quadric>  m_quadrics;
+    std::vector<size_t>   m_stamps;
+    std::vector<bool>     m_locked;
+    size_t m_next_stamp = 0;
+
+    std::priority_queue<Collapse> m_queue;
+    size_t m_next_order = 0;
+
+    // freed at the end, the queue still points to them
+    std::vector<he::vert3*> m_del_verts;
+    std::vector<he::edge3*> m_del_edges;
+    std::vector<he::loop3*> m_del_loops;
+
+}; // Decimator
+
+}
+
+namespace he
+{
+
+bool Polyhedron::Decimate(size_t target_faces, float max_error, CancelToken* cancel)
+{
+    assert(!m_log);
+
+    // the edits are logged to be undone on cancel
+    if (cancel) {
+        BeginTransaction();
+    }
+
+    bool succ;
+    {
+        Decimator decimator(*this, m_log);
+        succ = decimator.Run(target_faces, max_error, cancel);
+    }
+    if (!succ)
+    {
+        Rollback();
+        return false;
+    }
+    Commit();
+
+    // the collapses move verts all over
+    m_hash = 0;
+    SetAABBDirty();
+
+    return true;
+}
+
+}
@@ -1,116 +1,137 @@
 #include "halfedge/Polyhedron.h"
 #include "halfedge/Utility.h"
+#include "halfedge/CancelToken.h"
+#include "halfedge/SpatialHash.h"
+#include "halfedge/Circulator.h"
 
 #include <SM_Calc.h>
 
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 
 namespace
 {
 
-void BuildMapVert2Edges(const he::Polyhedron& src, std::vector<std::pair<he::vert3*, std::vector<he::edge3*>>>& dst)
+struct VertPairHash
 {
-    std::map<he::vert3*, size_t> vert2idx;
-
-    auto vert_first = src.GetVerts().Head();
-    auto vert_curr = vert_first;
-    size_t idx = 0;
-    do {
-        dst.push_back({ vert_curr, std::vector<he::edge3*>() });
-        vert2idx.insert({ vert_curr, idx++ });
-
-        vert_curr = vert_curr->linked_next;
-    } while (vert_curr != vert_first);
+    size_t operator () (const std::pair<he::vert3*, he::vert3*>& p) const {
+        const size_t h0 = std::hash<he::vert3*>()(p.first);
+        const size_t h1 = std::hash<he::vert3*>()(p.second);
+        return h0 ^ (h1 + 0x9e3779b9 + (h0 << 6) + (h0 >> 2));
+    }
+};
 
-    auto edge_first = src.GetEdges().Head();
-    auto edge_curr = edge_first;
-    do {
-        auto itr = vert2idx.find(edge_curr->vert);
-        assert(itr != vert2idx.end());
-        dst[itr->second].second.push_back(edge_curr);
-        edge_curr = edge_curr->linked_next;
-    } while (edge_curr != edge_first);
-}
+struct TopoIDHash
+{
+    size_t operator () (const he::TopoID& id) const {
+        return id.UID();
+    }
+};
 
-void BuildMapVert2Planes(const he::loop3& loop, size_t plane_idx, std::map<he::vert3*, std::set<size_t>>& dst)
+void BuildMapVert2Planes(const he::loop3& loop, size_t plane_idx, std::vector<std::pair<he::vert3*, size_t>>& dst)
 {
     auto first_e = loop.edge;
     auto curr_e = first_e;
     do {
-        auto itr = dst.find(curr_e->vert);
-        if (itr == dst.end()) {
-            dst.insert({ curr_e->vert, { plane_idx } });
-        } else {
-            itr->second.insert(plane_idx);
-        }
-
+        dst.push_back({ curr_e->vert, plane_idx });
         curr_e = curr_e->next;
     } while (curr_e != first_e);
 }
 
-void RemoveLoop(he::Polyhedron& poly, he::loop3* loop)
+// one pass over the face list, return true if a removed vert was on the aabb
+bool RemoveFaces(he::Polyhedron& poly, const std::vector<he::Polyhedron::Face>& faces, const sm::cube& aabb)
 {
-    const_cast<he::DoublyLinkedList<he::loop3>&>(poly.GetLoops()).Remove(loop);
+    if (faces.empty()) {
+        return false;
+    }
 
-    std::vector<std::pair<he::vert3*, std::vector<he::edge3*>>> vert2edges;
-    BuildMapVert2Edges(poly, vert2edges);
+    for (auto& f : faces) {
+        f.border->mark = 1;
+    }
+    auto& dst = const_cast<std::vector<he::Polyhedron::Face>&>(poly.GetFaces());
+    dst.erase(std::remove_if(dst.begin(), dst.end(), [](const he::Polyhedron::Face& f) {
+        return f.border->mark != 0;
+    }), dst.end());
 
-    std::vector<he::edge3*> del_edges;
-    auto first_edge = loop->edge;
-    auto curr_edge = first_edge;
-    do {
-        del_edges.push_back(curr_edge);
-        curr_edge->ids.MakeInvalid();
-        edge_del_pair(curr_edge);
-        const_cast<he::DoublyLinkedList<he::edge3>&>(poly.GetEdges()).Remove(curr_edge);
+    auto& verts = const_cast<he::DoublyLinkedList<he::vert3>&>(poly.GetVerts());
+    auto& edges = const_cast<he::DoublyLinkedList<he::edge3>&>(poly.GetEdges());
+    auto& loops = const_cast<he::DoublyLinkedList<he::loop3>&>(poly.GetLoops());
 
-        curr_edge = curr_edge->next;
-    } while (curr_edge != first_edge);
+    // the deletes wait until all the loops are off
+    std::vector<he::loop3*> del_loops;
+    std::vector<he::edge3*> del_edges;
+    auto remove_loop = [&](he::loop3* loop)
+    {
+        loops.Remove(loop);
+        del_loops.push_back(loop);
+        for (auto e : he::loop_edges(*loop)) {
+            e->mark = 1;
+            del_edges.push_back(e);
+        }
+    };
+    for (auto& f : faces)
+    {
+        remove_loop(f.border);
+        for (auto& hole : f.holes) {
+            remove_loop(hole);
+        }
+    }
 
-    for (auto& itr : vert2edges)
+    // the removed loops may split a vert's fan, so all the edges are searched
+    // for one still out of it, the verts without any are removed
+    std::unordered_map<he::vert3*, he::edge3*> vert2out;
+    for (auto& e : del_edges) {
+        vert2out.insert({ e->vert, nullptr });
+    }
+    for (auto e : edges)
     {
-        auto& v = itr.first;
-        assert(v->edge);
-        if (v->edge->ids.IsValid()) {
+        if (e->mark) {
             continue;
         }
+        auto itr = vert2out.find(e->vert);
+        if (itr != vert2out.end() && !itr->second) {
+            itr->second = e;
+        }
+    }
 
-        for (auto& e : itr.second) {
-            if (e->ids.IsValid()) {
-                v->edge = e;
-                break;
+    for (auto& e : del_edges)
+    {
+        e->ids.MakeInvalid();
+        edge_del_pair(e);
+        edges.Remove(e);
+    }
+
+    bool on_aabb = false;
+    for (auto& itr : vert2out)
+    {
+        auto v = itr.first;
+        if (itr.second)
+        {
+            if (v->edge->mark) {
+                v->edge = itr.second;
             }
+            continue;
         }
 
-        if (!v->edge->ids.IsValid()) {
-            const_cast<he::DoublyLinkedList<he::vert3>&>(poly.GetVerts()).Remove(v);
-            delete v;
+        if (!on_aabb && he::Utility::IsPointOnAABB(aabb, v->position)) {
+            on_aabb = true;
         }
+        verts.Remove(v);
+        delete v;
     }
-
     for (auto& e : del_edges) {
         delete e;
     }
-    delete loop;
-}
-
-void RemoveFace(he::Polyhedron& poly, const he::Polyhedron::Face& face)
-{
-    RemoveLoop(poly, face.border);
-    for (auto& hole : face.holes) {
-        RemoveLoop(poly, hole);
+    for (auto& l : del_loops) {
+        delete l;
     }
 
-    auto& faces = const_cast<std::vector<he::Polyhedron::Face>&>(poly.GetFaces());
-    for (auto itr = faces.begin(); itr != faces.end(); ++itr) {
-        if (itr->border == face.border) {
-            faces.erase(itr);
-            break;
-        }
-    }
+    return on_aabb;
 }
 
-he::loop3* CloneLoop(he::loop3* loop, std::map<he::vert3*, he::vert3*>& vert_old2new, std::vector<he::vert3*>& new_vts,
+he::loop3* CloneLoop(he::loop3* loop, std::unordered_map<he::vert3*, he::vert3*>& vert_old2new, std::vector<he::vert3*>& new_vts,
                      size_t& next_vert_id, size_t& next_edge_id, size_t& next_loop_id)
 {
     auto new_face = new he::loop3(next_loop_id++);
@@ -232,13 +253,139 @@ void CreateSideFaces(const he::loop3& old_loop, const he::loop3& new_loop,
     }
 }
 
+// the two sides of the loops coplanar, all verts of l1 on the plane of l0
+bool is_loop_coplanar(const sm::Plane& plane0, const sm::Plane& plane1, const he::loop3& l1)
+{
+    if (plane0.normal.Dot(plane1.normal) <= 0) {
+        return false;
+    }
+
+    auto first_e = l1.edge;
+    auto curr_e = first_e;
+    do {
+        if (he::Utility::CalcPointPlaneStatus(plane0, curr_e->vert->position) != he::Utility::PointStatus::Inside) {
+            return false;
+        }
+        curr_e = curr_e->next;
+    } while (curr_e != first_e);
+
+    return true;
+}
+
+// u -> v -> w on a line
+bool is_collinear(const sm::vec3& u, const sm::vec3& v, const sm::vec3& w)
+{
+    const auto d0 = v - u;
+    const auto d1 = w - v;
+    if (d0.Dot(d1) <= 0) {
+        return false;
+    }
+    const float eps = he::Utility::POINT_STATUS_EPSILON;
+    return d0.Cross(d1).LengthSquared() <= eps * eps * (d0 + d1).LengthSquared();
+}
+
 }
 
 namespace he
 {
 
+void Polyhedron::AppendCopy(const Polyhedron& poly)
+{
+    // ids are counted per poly, move poly's after ours, as Join
+    const size_t v_off = m_next_vert_id;
+    const size_t e_off = m_next_edge_id;
+    const size_t l_off = m_next_loop_id;
+    auto offset = [](TopoID ids, size_t off) {
+        if (off != 0) {
+            ids.Offset(off);
+        }
+        return ids;
+    };
+
+    std::unordered_map<const vert3*, vert3*> vert2new;
+    std::unordered_map<const edge3*, edge3*> edge2new;
+    std::unordered_map<const loop3*, loop3*> loop2new;
+    vert2new.reserve(poly.m_verts.Size());
+    edge2new.reserve(poly.m_edges.Size());
+    loop2new.reserve(poly.m_loops.Size());
+
+    if (auto first_v = poly.m_verts.Head())
+    {
+        auto curr_v = first_v;
+        do {
+            auto v = new vert3(curr_v->position, offset(curr_v->ids, v_off));
+            vert2new.insert({ curr_v, v });
+            m_verts.Append(v);
+            curr_v = curr_v->linked_next;
+        } while (curr_v != first_v);
+    }
+
+    if (auto first_l = poly.m_loops.Head())
+    {
+        auto curr_l = first_l;
+        do {
+            auto l = new loop3(offset(curr_l->ids, l_off));
+            loop2new.insert({ curr_l, l });
+            m_loops.Append(l);
+            curr_l = curr_l->linked_next;
+        } while (curr_l != first_l);
+    }
+
+    if (auto first_e = poly.m_edges.Head())
+    {
+        auto curr_e = first_e;
+        do {
+            auto e = new edge3(vert2new[curr_e->vert], curr_e->loop ? loop2new[curr_e->loop] : nullptr, offset(curr_e->ids, e_off));
+            edge2new.insert({ curr_e, e });
+            m_edges.Append(e);
+            curr_e = curr_e->linked_next;
+        } while (curr_e != first_e);
+
+        // links after all edges are created
+        curr_e = first_e;
+        do {
+            auto e = edge2new[curr_e];
+            e->prev = curr_e->prev ? edge2new[curr_e->prev] : nullptr;
+            e->next = curr_e->next ? edge2new[curr_e->next] : nullptr;
+            e->twin = curr_e->twin ? edge2new[curr_e->twin] : nullptr;
+            curr_e = curr_e->linked_next;
+        } while (curr_e != first_e);
+    }
+
+    for (auto& itr : vert2new) {
+        if (itr.first->edge) {
+            itr.second->edge = edge2new[itr.first->edge];
+        }
+    }
+    for (auto& itr : loop2new) {
+        itr.second->edge = edge2new[itr.first->edge];
+    }
+
+    m_faces.reserve(m_faces.size() + poly.m_faces.size());
+    for (auto& src : poly.m_faces)
+    {
+        Face dst(loop2new[src.border]);
+        dst.holes.reserve(src.holes.size());
+        for (auto& hole : src.holes) {
+            dst.holes.push_back(loop2new[hole]);
+        }
+        m_faces.push_back(dst);
+    }
+
+    m_next_vert_id = v_off + poly.m_next_vert_id;
+    m_next_edge_id = e_off + poly.m_next_edge_id;
+    m_next_loop_id = l_off + poly.m_next_loop_id;
+
+    CombineAABB(poly.GetAABB());
+    m_hash = 0;
+}
+
 void Polyhedron::Fill()
 {
+    assert(!m_log);
+
+    m_hash = 0;
+
     std::map<vert3*, edge3*> new_edges;
 
     // create edges
@@ -285,105 +432,532 @@ void Polyhedron::Fill()
     }
 }
 
-void Polyhedron::Fuse(float distance)
+bool Polyhedron::Fuse(float distance, CancelToken* cancel, bool parallel)
 {
-    std::vector<std::pair<he::vert3*, std::vector<he::edge3*>>> vert2edges;
-    BuildMapVert2Edges(*this, vert2edges);
+    assert(!m_log);
 
-    for (auto itr0 = vert2edges.begin(); itr0 != vert2edges.end(); ++itr0)
+    if (distance <= 0) {
+        return true;
+    }
+
+    const size_t num = m_verts.Size();
+
+    std::vector<vert3*> verts;
+    verts.reserve(num);
+    std::unordered_map<const vert3*, size_t> vert2idx;
+    vert2idx.reserve(num);
+    for (auto v : m_verts) {
+        vert2idx.insert({ v, verts.size() });
+        verts.push_back(v);
+    }
+
+    // grid of the distance, only the neighbor cells are tested
+    SpatialHash<size_t> grid(distance);
+    grid.Reserve(num);
+    for (size_t i = 0; i < num; ++i) {
+        grid.Insert(verts[i]->position, i);
+    }
+
+    // the later verts close to each vert, the grid is only read here
+    std::vector<std::vector<size_t>> neighbors(num);
+    auto query = [&](size_t i)
     {
-        if (!itr0->first->ids.IsValid()) {
-            continue;
+        if (cancel && cancel->IsCancelled()) {
+            return;
         }
 
-        auto itr1 = itr0;
-        ++itr1;
-        for (; itr1 != vert2edges.end(); ++itr1)
-        {
-            if (!itr1->first->ids.IsValid()) {
-                continue;
+        auto& dst = neighbors[i];
+        grid.Query(verts[i]->position, distance, [&](const sm::vec3&, size_t j) -> bool {
+            if (j > i) {
+                dst.push_back(j);
             }
+            return false;
+        });
+        std::sort(dst.begin(), dst.end());
+    };
+    if (parallel) {
+        Utility::ParallelFor(num, query);
+    } else {
+        for (size_t i = 0; i < num; ++i) {
+            query(i);
+        }
+    }
 
-            auto d = sm::dis_pos3_to_pos3(
-                itr0->first->position, itr1->first->position
-            );
-            if (d >= distance) {
-                continue;
-            }
+    // find the targets first, so a cancel changes nothing,
+    // each vert takes the later ones close to it, in list order
+    const size_t NIL = static_cast<size_t>(-1);
+    const size_t CHECK_BLOCK = 1024;
+    std::vector<size_t> targets(num, NIL);
+    for (size_t i = 0; i < num; ++i)
+    {
+        // the token is checked once for each block of verts done
+        if (cancel && i > 0 && i % CHECK_BLOCK == 0 && !cancel->Check(CHECK_BLOCK)) {
+            return false;
+        }
+
+        if (targets[i] != NIL || !verts[i]->ids.IsValid()) {
+            continue;
+        }
 
-            for (auto& edge : itr1->second) {
-                edge->vert = itr0->first;
+        for (auto& j : neighbors[i]) {
+            if (targets[j] == NIL && verts[j]->ids.IsValid()) {
+                targets[j] = i;
             }
-            itr1->first->ids.MakeInvalid();
-            m_verts.Remove(itr1->first);
         }
     }
+    // the rest of the last block
+    if (cancel && !cancel->Check(num - (num > 0 ? (num - 1) / CHECK_BLOCK * CHECK_BLOCK : 0))) {
+        return false;
+    }
 
-    for (auto itr : vert2edges) {
-        if (!itr.first->ids.IsValid()) {
-            delete itr.first;
+    // one pass over the edges, the fans of a welded vert may be apart
+    for (auto e : m_edges)
+    {
+        const size_t t = targets[vert2idx.find(e->vert)->second];
+        if (t != NIL) {
+            e->vert = verts[t];
+        }
+    }
+    for (size_t i = 0; i < num; ++i)
+    {
+        if (targets[i] == NIL) {
+            continue;
         }
+
+        auto vert = verts[i];
+        vert->ids.MakeInvalid();
+        ShrinkAABB(vert->position);
+        m_verts.Remove(vert);
+        delete vert;
     }
 
-    UpdateAABB();
+    m_hash = 0;
+
+    return true;
 }
 
-PolyhedronPtr Polyhedron::Fuse(const std::vector<PolyhedronPtr>& polys, float distance)
+PolyhedronPtr Polyhedron::Fuse(const std::vector<PolyhedronPtr>& polys, float distance,
+                               CancelToken* cancel, bool parallel)
 {
-    std::vector<in_vert> verts;
-    std::vector<in_face> faces;
-
-    std::map<size_t, size_t> vert_uid2pos;
+    // ids of each poly are moved after the ones before it
+    auto ret = std::make_shared<Polyhedron>();
     for (auto& poly : polys)
     {
-        auto first_vert = poly->GetVerts().Head();
-        auto curr_vert = first_vert;
-        do {
-            auto ret = vert_uid2pos.insert({ curr_vert->ids.UID(), verts.size() });
-            assert(ret.second);
-            verts.push_back({ curr_vert->ids, curr_vert->position });
-            curr_vert = curr_vert->linked_next;
-        } while (curr_vert != first_vert);
+        if (cancel && cancel->IsCancelled()) {
+            return nullptr;
+        }
+        if (poly) {
+            ret->AppendCopy(*poly);
+        }
+    }
+    if (ret->m_verts.Size() == 0) {
+        return ret;
     }
 
-    for (auto& poly : polys)
+    if (!ret->Fuse(distance, cancel, parallel)) {
+        return nullptr;
+    }
+
+    // pair u -> v with v -> u, the seams between the polys
+    std::unordered_map<std::pair<vert3*, vert3*>, edge3*, VertPairHash> open_edges;
+    auto first_e = ret->m_edges.Head();
+    auto curr_e = first_e;
+    do {
+        if (!curr_e->twin && curr_e->next) {
+            open_edges.insert({ { curr_e->vert, curr_e->next->vert }, curr_e });
+        }
+        curr_e = curr_e->linked_next;
+    } while (curr_e != first_e);
+
+    for (auto& itr : open_edges)
     {
-        auto first_l = poly->GetLoops().Head();
-        auto curr_l = first_l;
-        do {
-            in_loop border;
+        auto e = itr.second;
+        if (e->twin) {
+            continue;
+        }
+        auto twin = open_edges.find({ itr.first.second, itr.first.first });
+        if (twin != open_edges.end() && !twin->second->twin && twin->second != e) {
+            edge_make_pair(e, twin->second);
+        }
+    }
 
-            auto first_edge = curr_l->edge;
-            auto curr_edge = first_edge;
-            do {
-                auto itr = vert_uid2pos.find(curr_edge->vert->ids.UID());
-                assert(itr != vert_uid2pos.end());
-                border.push_back(itr->second);
+    return ret;
+}
 
-                curr_edge = curr_edge->next;
-            } while (curr_edge != first_edge);
+void Polyhedron::UniquePoints()
+{
+    assert(!m_log);
 
-            std::vector<in_loop> holes;
+    Utility::UniquePoints(m_verts, m_edges, m_next_vert_id);
+    m_hash = 0;
+}
 
-            faces.emplace_back(curr_l->ids, border, holes);
+void Polyhedron::MergeCoplanarFaces()
+{
+    assert(!m_log);
 
-            curr_l = curr_l->linked_next;
-        } while (curr_l != first_l);
+    m_hash = 0;
+
+    if (m_edges.Size() == 0) {
+        return;
     }
 
-    auto ret = std::make_shared<Polyhedron>(verts, faces);
-    ret->Fuse(distance);
-    return ret;
+    // faces with holes are kept
+    std::unordered_map<loop3*, sm::Plane> planes;
+    for (auto& face : m_faces)
+    {
+        if (face.border && face.holes.empty())
+        {
+            sm::Plane plane;
+            Utility::LoopToPlane(*face.border, plane);
+            planes.insert({ face.border, plane });
+        }
+    }
+
+    std::vector<edge3*> edges;
+    edges.reserve(m_edges.Size());
+    auto first_e = m_edges.Head();
+    auto curr_e = first_e;
+    do {
+        edges.push_back(curr_e);
+        curr_e = curr_e->linked_next;
+    } while (curr_e != first_e);
+
+    // dissolve the edges between coplanar faces, deletes wait to the end
+    std::vector<edge3*> del_edges;
+    std::vector<loop3*> del_loops;
+    auto del_edge = [&](edge3* e) {
+        e->mark = 1;
+        m_edges.Remove(e);
+        del_edges.push_back(e);
+    };
+    for (auto& e : edges)
+    {
+        auto t = e->twin;
+        if (e->mark || !t || e->loop == t->loop) {
+            continue;
+        }
+
+        auto itr0 = planes.find(e->loop);
+        auto itr1 = planes.find(t->loop);
+        if (itr0 == planes.end() || itr1 == planes.end() ||
+            !is_loop_coplanar(itr0->second, itr1->second, *t->loop)) {
+            continue;
+        }
+
+        auto keep = e->loop;
+        auto drop = t->loop;
+        for (auto te = t->next; te != t; te = te->next) {
+            te->loop = keep;
+        }
+
+        e->prev->Connect(t->next);
+        t->prev->Connect(e->next);
+        if (e->vert->edge == e) {
+            e->vert->edge = t->next;
+        }
+        if (t->vert->edge == t) {
+            t->vert->edge = e->next;
+        }
+        if (keep->edge == e) {
+            keep->edge = e->next;
+        }
+
+        planes.erase(drop);
+        drop->mark = 1;
+        m_loops.Remove(drop);
+        del_loops.push_back(drop);
+
+        del_edge(e);
+        del_edge(t);
+    }
+
+    // spurs left by faces sharing a run of edges, e: u -> v, twin: v -> u
+    std::vector<edge3*> spurs;
+    for (auto& e : edges) {
+        if (!e->mark && e->twin && e->next == e->twin && e->prev != e->twin) {
+            spurs.push_back(e);
+        }
+    }
+    while (!spurs.empty())
+    {
+        auto e = spurs.back();
+        spurs.pop_back();
+        if (e->mark || e->next != e->twin || e->prev == e->twin) {
+            continue;
+        }
+
+        auto t = e->twin;
+        auto tip = t->vert;
+        auto prev = e->prev;
+        prev->Connect(t->next);
+        if (e->vert->edge == e) {
+            e->vert->edge = t->next;
+        }
+        if (e->loop->edge == e || e->loop->edge == t) {
+            e->loop->edge = prev;
+        }
+        if (tip->edge == t)
+        {
+            ShrinkAABB(tip->position);
+            m_verts.Remove(tip);
+            delete tip;
+        }
+
+        del_edge(e);
+        del_edge(t);
+
+        if (prev->twin && prev->next == prev->twin) {
+            spurs.push_back(prev);
+        }
+    }
+
+    // verts left in the middle of a straight edge
+    std::vector<vert3*> verts;
+    verts.reserve(m_verts.Size());
+    auto first_v = m_verts.Head();
+    auto curr_v = first_v;
+    do {
+        verts.push_back(curr_v);
+        curr_v = curr_v->linked_next;
+    } while (curr_v != first_v);
+    for (auto& v : verts)
+    {
+        auto e0 = v->edge;
+        auto p0 = e0->prev;
+        auto e1 = p0->twin;
+        if (!e0->twin || !e1 || e1 == e0 || e1->prev->twin != e0) {
+            continue;
+        }
+
+        // keep triangles
+        if (e0->next->next == p0 || e1->next->next == e1->prev) {
+            continue;
+        }
+
+        if (!is_collinear(p0->vert->position, v->position, e0->next->vert->position)) {
+            continue;
+        }
+
+        // p0: u -> v, e0: v -> w, p1: w -> v, e1: v -> u
+        auto p1 = e1->prev;
+        p0->Connect(e0->next);
+        p1->Connect(e1->next);
+        if (e0->loop->edge == e0) {
+            e0->loop->edge = p0;
+        }
+        if (e1->loop->edge == e1) {
+            e1->loop->edge = p1;
+        }
+        edge_del_pair(p0);
+        edge_del_pair(p1);
+        edge_make_pair(p0, p1);
+
+        ShrinkAABB(v->position);
+        m_verts.Remove(v);
+        delete v;
+
+        del_edge(e0);
+        del_edge(e1);
+    }
+
+    m_faces.erase(std::remove_if(m_faces.begin(), m_faces.end(), [](const Face& face) {
+        return face.border && face.border->mark;
+    }), m_faces.end());
+
+    for (auto& e : del_edges) {
+        delete e;
+    }
+    for (auto& l : del_loops) {
+        delete l;
+    }
 }
 
-void Polyhedron::UniquePoints()
+void Polyhedron::Triangulate()
 {
-    Utility::UniquePoints(m_verts, m_edges, m_next_vert_id);
+    assert(!m_log);
+
+    m_hash = 0;
+
+    std::vector<size_t> tris;
+    std::vector<vert3*> verts;
+    std::vector<edge3*> edges;
+    std::vector<size_t> next;
+    std::unordered_map<size_t, edge3*> diagonals;
+    for (size_t i = 0, n = m_faces.size(); i < n; ++i)
+    {
+        auto face = m_faces[i];
+        if (face.holes.empty() && Utility::EdgeSize(*face.border) == 3) {
+            continue;
+        }
+
+        tris.clear();
+        Utility::TriangulateFace(face, tris);
+        if (tris.empty()) {
+            continue;
+        }
+
+        // by index, the loops in the order of TriangulateFace
+        verts.clear();
+        edges.clear();
+        next.clear();
+        auto add_loop = [&](loop3* loop)
+        {
+            const size_t begin = edges.size();
+            auto first_e = loop->edge;
+            auto curr_e = first_e;
+            do {
+                verts.push_back(curr_e->vert);
+                edges.push_back(curr_e);
+                next.push_back(edges.size());
+                curr_e = curr_e->next;
+            } while (curr_e != first_e);
+            next.back() = begin;
+        };
+        add_loop(face.border);
+        for (auto& hole : face.holes) {
+            add_loop(hole);
+        }
+
+        // the loop edges are moved to the triangles, the diagonals are new and paired
+        diagonals.clear();
+        const size_t num = verts.size();
+        for (size_t j = 0, m = tris.size(); j < m; j += 3)
+        {
+            loop3* loop = nullptr;
+            if (j == 0) {
+                loop = face.border;
+            } else {
+                loop = new loop3(m_next_loop_id++);
+                m_loops.Append(loop);
+                m_faces.emplace_back(loop);
+            }
+
+            edge3* tri[3];
+            for (size_t k = 0; k < 3; ++k)
+            {
+                const size_t from = tris[j + k];
+                const size_t to = tris[j + (k + 1) % 3];
+                if (next[from] == to)
+                {
+                    tri[k] = edges[from];
+                    tri[k]->loop = loop;
+                }
+                else
+                {
+                    tri[k] = new edge3(verts[from], loop, m_next_edge_id++);
+                    m_edges.Append(tri[k]);
+
+                    auto itr = diagonals.find(to * num + from);
+                    if (itr != diagonals.end()) {
+                        edge_make_pair(tri[k], itr->second);
+                        diagonals.erase(itr);
+                    } else {
+                        diagonals.insert({ from * num + to, tri[k] });
+                    }
+                }
+            }
+            tri[0]->Connect(tri[1])->Connect(tri[2])->Connect(tri[0]);
+            loop->edge = tri[0];
+        }
+
+        for (auto& hole : face.holes)
+        {
+            m_loops.Remove(hole);
+            delete hole;
+        }
+        m_faces[i].holes.clear();
+    }
+}
+
+void Polyhedron::Smooth(size_t iterations, float lambda, float mu, bool lock_border)
+{
+    assert(!m_log);
+
+    const size_t num = m_verts.Size();
+    if (num == 0 || iterations == 0) {
+        return;
+    }
+
+    std::unordered_map<const vert3*, size_t> vert2idx;
+    vert2idx.reserve(num);
+    std::vector<sm::vec3> pts;
+    pts.reserve(num);
+    auto first_v = m_verts.Head();
+    auto curr_v = first_v;
+    do {
+        vert2idx.insert({ curr_v, pts.size() });
+        pts.push_back(curr_v->position);
+        curr_v = curr_v->linked_next;
+    } while (curr_v != first_v);
+
+    // the one rings by the half-edges, an open edge is seen from one side only,
+    // so it adds both ends
+    std::vector<std::pair<size_t, size_t>> links;
+    links.reserve(m_edges.Size());
+    std::vector<size_t> ring_begin(num + 1, 0);
+    std::vector<bool> border(num, false);
+    auto first_e = m_edges.Head();
+    auto curr_e = first_e;
+    do {
+        const size_t v0 = vert2idx.find(curr_e->vert)->second;
+        const size_t v1 = vert2idx.find(curr_e->next->vert)->second;
+        if (v0 != v1)
+        {
+            links.push_back({ v0, v1 });
+            ++ring_begin[v0 + 1];
+            if (!curr_e->twin)
+            {
+                links.push_back({ v1, v0 });
+                ++ring_begin[v1 + 1];
+                border[v0] = border[v1] = true;
+            }
+        }
+        curr_e = curr_e->linked_next;
+    } while (curr_e != first_e);
+
+    // locked verts get empty rings
+    if (lock_border) {
+        for (size_t i = 0; i < num; ++i) {
+            if (border[i]) {
+                ring_begin[i + 1] = 0;
+            }
+        }
+    }
+    for (size_t i = 0; i < num; ++i) {
+        ring_begin[i + 1] += ring_begin[i];
+    }
+
+    std::vector<size_t> rings(ring_begin.back());
+    std::vector<size_t> cursor(ring_begin.begin(), ring_begin.end() - 1);
+    for (auto& l : links) {
+        if (!lock_border || !border[l.first]) {
+            rings[cursor[l.first]++] = l.second;
+        }
+    }
+
+    std::vector<float> factors = { lambda };
+    if (mu != 0) {
+        factors.push_back(mu);
+    }
+    Utility::SmoothPoints(pts, ring_begin, rings, factors, iterations);
+
+    size_t idx = 0;
+    curr_v = first_v;
+    do {
+        curr_v->position = pts[idx++];
+        curr_v = curr_v->linked_next;
+    } while (curr_v != first_v);
+
+    m_hash = 0;
+    SetAABBDirty();
 }
 
 bool Polyhedron::Extrude(float distance, const std::vector<TopoID>& face_ids, bool create_face[ExtrudeMaxCount],
-                         std::vector<Face>* new_faces)
+                         std::vector<Face>* new_faces, CancelToken* cancel)
 {
+    assert(!m_log);
+
     if (distance == 0) {
         return false;
     }
@@ -392,9 +966,11 @@ bool Polyhedron::Extrude(float distance, const std::vector<TopoID>& face_ids, bo
     const bool add_back  = create_face[ExtrudeBack];
     const bool add_side  = create_face[ExtrudeSide];
 
+    // flat vert to planes, sorted by vert then plane
     std::vector<sm::Plane> planes;
-    std::map<he::vert3*, std::set<size_t>> vert2planes;
+    std::vector<std::pair<he::vert3*, size_t>> vert2planes;
     planes.reserve(m_faces.size());
+    vert2planes.reserve(m_edges.Size());
     for (auto& face : m_faces)
     {
         size_t idx = planes.size();
@@ -408,26 +984,53 @@ bool Polyhedron::Extrude(float distance, const std::vector<TopoID>& face_ids, bo
             BuildMapVert2Planes(*hole, idx, vert2planes);
         }
     }
+    std::sort(vert2planes.begin(), vert2planes.end());
+    vert2planes.erase(std::unique(vert2planes.begin(), vert2planes.end()), vert2planes.end());
+
+    std::unordered_set<TopoID, TopoIDHash> selected(face_ids.begin(), face_ids.end());
 
     std::vector<Face> old_front_faces;
 
     std::vector<vert3*> new_vts;
-    std::map<vert3*, vert3*> vert_old2new;
+    std::unordered_map<vert3*, vert3*> vert_old2new;
 
     std::vector<Face> new_front_faces;
 
+    // the new elements are not linked before all faces are done,
+    // a cancel drops them and restores the ids
+    const size_t next_vert_id = m_next_vert_id;
+    const size_t next_edge_id = m_next_edge_id;
+    const size_t next_loop_id = m_next_loop_id;
+    auto rollback = [&]()
+    {
+        for (auto& v : new_vts) {
+            delete v;
+        }
+        for (auto& f : new_front_faces)
+        {
+            DeleteEdges(*f.border);
+            delete f.border;
+            for (auto& hole : f.holes) {
+                DeleteEdges(*hole);
+                delete hole;
+            }
+        }
+
+        m_next_vert_id = next_vert_id;
+        m_next_edge_id = next_edge_id;
+        m_next_loop_id = next_loop_id;
+    };
+
     size_t plane_idx = 0;
     for (auto& face : m_faces)
     {
-        bool find = false;
-        for (auto& id : face_ids) {
-            if (id == face.border->ids) {
-                find = true;
-                break;
-            }
+        if (cancel && !cancel->Check())
+        {
+            rollback();
+            return false;
         }
 
-        if (find)
+        if (selected.find(face.border->ids) != selected.end())
         {
             planes[plane_idx].dist -= distance;
 
@@ -447,20 +1050,25 @@ bool Polyhedron::Extrude(float distance, const std::vector<TopoID>& face_ids, bo
         ++plane_idx;
     }
 
-    // offset verts
-    for (auto itr : vert_old2new)
+    // offset verts, each solved alone
+    std::vector<std::pair<vert3*, vert3*>> offset(vert_old2new.begin(), vert_old2new.end());
+    Utility::ParallelFor(offset.size(), [&](size_t idx)
     {
-        auto itr_planes = vert2planes.find(itr.first);
-        assert(itr_planes != vert2planes.end());
-        auto& p_ids = itr_planes->second;
-        if (p_ids.size() < 3)
+        auto& itr = offset[idx];
+        auto range = std::equal_range(vert2planes.begin(), vert2planes.end(), std::make_pair(itr.first, size_t(0)),
+            [](const std::pair<he::vert3*, size_t>& a, const std::pair<he::vert3*, size_t>& b) {
+                return a.first < b.first;
+            });
+        assert(range.first != range.second);
+        const size_t num = std::distance(range.first, range.second);
+        auto p_ids = range.first;
+        if (num < 3)
         {
-            assert(!p_ids.empty());
-            auto& p0 = planes[*p_ids.begin()];
+            auto& p0 = planes[p_ids->second];
             auto edge = itr.first->edge;
             auto prev_edge = edge->prev;
             assert(edge && prev_edge);
-            if (p_ids.size() == 1)
+            if (num == 1)
             {
                 auto p1 = sm::Plane(p0.normal.Cross(edge->next->vert->position - edge->vert->position), itr.first->position);
                 auto p2 = sm::Plane(p0.normal.Cross(prev_edge->next->vert->position - prev_edge->vert->position), itr.first->position);
@@ -475,8 +1083,8 @@ bool Polyhedron::Extrude(float distance, const std::vector<TopoID>& face_ids, bo
             }
             else
             {
-                assert(p_ids.size() == 2);
-                auto& p1 = planes[*++p_ids.begin()];
+                assert(num == 2);
+                auto& p1 = planes[(p_ids + 1)->second];
                 auto p2 = sm::Plane(p0.normal.Cross(edge->next->vert->position - edge->vert->position), itr.first->position);
                 if (!sm::intersect_planes(p0, p1, p2, &itr.second->position))
                 {
@@ -490,18 +1098,18 @@ bool Polyhedron::Extrude(float distance, const std::vector<TopoID>& face_ids, bo
         }
         else
         {
-            auto i = p_ids.begin();
-            auto& p0 = planes[*i++];
-            auto& p1 = planes[*i++];
-            auto& p2 = planes[*i++];
+            auto& p0 = planes[p_ids[0].second];
+            auto& p1 = planes[p_ids[1].second];
+            auto& p2 = planes[p_ids[2].second];
             bool intersect = sm::intersect_planes(p0, p1, p2, &itr.second->position);
             assert(intersect);
         }
-    }
+    });
 
     // use new vts
     if (add_front || add_side) {
         for (auto& v : new_vts) {
+            CombineAABB(v->position);
             m_verts.Append(v);
         }
     } else {
@@ -691,11 +1299,10 @@ bool Polyhedron::Extrude(float distance, const std::vector<TopoID>& face_ids, bo
     }
 
     // rm old faces
-    for (auto& f : old_front_faces) {
-        RemoveFace(*this, f);
+    if (RemoveFaces(*this, old_front_faces, m_aabb)) {
+        SetAABBDirty();
     }
-
-    UpdateAABB();
+    m_hash = 0;
 
     // return
     if (new_faces)
@@ -0,0 +1,475 @@
+#include "halfedge/Polyhedron.h"
+#include "halfedge/Utility.h"
+
+#include <unordered_map>
+
+namespace
+{
+
+const size_t NONE = static_cast<size_t>(-1);
+
+// the connectivity in flat arrays, the halfs of a face are contiguous
+struct FlatMesh
+{
+    std::vector<sm::vec3> verts;
+
+    std::vector<size_t> face_begin;    // face num + 1
+
+    std::vector<size_t> half_vert;     // origin
+    std::vector<size_t> half_face;
+    std::vector<size_t> half_twin;     // NONE for open
+    std::vector<size_t> half_edge;     // undirected
+
+    std::vector<size_t> edge_half;     // one of the halfs
+
+    size_t FaceNum() const { return face_begin.size() - 1; }
+    size_t HalfNum() const { return half_vert.size(); }
+    size_t EdgeNum() const { return edge_half.size(); }
+
+    size_t Next(size_t h) const {
+        return h + 1 == face_begin[half_face[h] + 1] ? face_begin[half_face[h]] : h + 1;
+    }
+    size_t Prev(size_t h) const {
+        return h == face_begin[half_face[h]] ? face_begin[half_face[h] + 1] - 1 : h - 1;
+    }
+    size_t Dest(size_t h) const {
+        return half_vert[Next(h)];
+    }
+
+    // from the twins, an edge for each open half or pair
+    void BuildEdges()
+    {
+        const size_t n = HalfNum();
+        half_edge.resize(n);
+        edge_half.clear();
+        edge_half.reserve(n / 2 + 1);
+        for (size_t h = 0; h < n; ++h)
+        {
+            const size_t t = half_twin[h];
+            if (t == NONE || h < t) {
+                half_edge[h] = edge_half.size();
+                edge_half.push_back(h);
+            } else {
+                half_edge[h] = half_edge[t];
+            }
+        }
+    }
+
+    void BuildFaceOfHalfs()
+    {
+        half_face.resize(HalfNum());
+        he::Utility::ParallelForBlocks(FaceNum(), [&](size_t f) {
+            for (size_t h = face_begin[f]; h < face_begin[f + 1]; ++h) {
+                half_face[h] = f;
+            }
+        });
+    }
+
+}; // FlatMesh
+
+// out halfs of each vert, and the two verts along the border for the open ones
+struct VertRing
+{
+    VertRing(const FlatMesh& mesh)
+    {
+        const size_t nv = mesh.verts.size();
+        const size_t nh = mesh.HalfNum();
+
+        begin.assign(nv + 1, 0);
+        for (size_t h = 0; h < nh; ++h) {
+            ++begin[mesh.half_vert[h] + 1];
+        }
+        for (size_t v = 0; v < nv; ++v) {
+            begin[v + 1] += begin[v];
+        }
+        halfs.resize(nh);
+        std::vector<size_t> cursor(begin.begin(), begin.end() - 1);
+        for (size_t h = 0; h < nh; ++h) {
+            halfs[cursor[mesh.half_vert[h]]++] = h;
+        }
+
+        border_num.assign(nv, 0);
+        border.resize(nv * 2);
+        for (size_t h = 0; h < nh; ++h)
+        {
+            if (mesh.half_twin[h] != NONE) {
+                continue;
+            }
+            const size_t a = mesh.half_vert[h];
+            const size_t b = mesh.Dest(h);
+            if (border_num[a] < 2) {
+                border[a * 2 + border_num[a]] = b;
+            }
+            ++border_num[a];
+            if (border_num[b] < 2) {
+                border[b * 2 + border_num[b]] = a;
+            }
+            ++border_num[b];
+        }
+    }
+
+    // the border rule with two, more is a corner and stays
+    bool CalcBorderPos(const FlatMesh& mesh, size_t v, sm::vec3& pos) const
+    {
+        if (border_num[v] == 0) {
+            return false;
+        }
+        if (border_num[v] == 2) {
+            pos = (mesh.verts[border[v * 2]] + mesh.verts[v] * 6 + mesh.verts[border[v * 2 + 1]]) * (1.0f / 8);
+        } else {
+            pos = mesh.verts[v];
+        }
+        return true;
+    }
+
+    std::vector<size_t> begin;
+    std::vector<size_t> halfs;
+
+    std::vector<size_t> border_num;
+    std::vector<size_t> border;
+
+}; // VertRing
+
+FlatMesh BuildFlatMesh(const he::Polyhedron& poly)
+{
+    FlatMesh ret;
+
+    std::unordered_map<const he::vert3*, size_t> vert2idx;
+    vert2idx.reserve(poly.GetVerts().Size());
+    ret.verts.reserve(poly.GetVerts().Size());
+    if (auto first_v = poly.GetVerts().Head())
+    {
+        auto curr_v = first_v;
+        do {
+            vert2idx.insert({ curr_v, ret.verts.size() });
+            ret.verts.push_back(curr_v->position);
+            curr_v = curr_v->linked_next;
+        } while (curr_v != first_v);
+    }
+
+    std::unordered_map<const he::edge3*, size_t> half2idx;
+    half2idx.reserve(poly.GetEdges().Size());
+    std::vector<const he::edge3*> halfs;
+    halfs.reserve(poly.GetEdges().Size());
+    ret.face_begin.reserve(poly.GetFaces().size() + 1);
+    ret.half_vert.reserve(poly.GetEdges().Size());
+    for (auto& face : poly.GetFaces())
+    {
+        ret.face_begin.push_back(halfs.size());
+
+        auto first_e = face.border->edge;
+        auto curr_e = first_e;
+        do {
+            half2idx.insert({ curr_e, halfs.size() });
+            halfs.push_back(curr_e);
+            ret.half_vert.push_back(vert2idx.find(curr_e->vert)->second);
+            curr_e = curr_e->next;
+        } while (curr_e != first_e);
+    }
+    ret.face_begin.push_back(halfs.size());
+
+    ret.half_twin.resize(halfs.size(), NONE);
+    for (size_t h = 0, n = halfs.size(); h < n; ++h)
+    {
+        if (!halfs[h]->twin) {
+            continue;
+        }
+        auto itr = half2idx.find(halfs[h]->twin);
+        if (itr != half2idx.end()) {
+            ret.half_twin[h] = itr->second;
+        }
+    }
+
+    ret.BuildFaceOfHalfs();
+    ret.BuildEdges();
+
+    return ret;
+}
+
+// a quad for each corner, the new verts are the old, then the edges, then the faces
+FlatMesh CatmullClark(const FlatMesh& src)
+{
+    const size_t nv = src.verts.size();
+    const size_t ne = src.EdgeNum();
+    const size_t nf = src.FaceNum();
+    const size_t nh = src.HalfNum();
+
+    FlatMesh dst;
+    dst.verts.resize(nv + ne + nf);
+
+    // face points
+    he::Utility::ParallelForBlocks(nf, [&](size_t f)
+    {
+        sm::vec3 sum;
+        for (size_t h = src.face_begin[f]; h < src.face_begin[f + 1]; ++h) {
+            sum += src.verts[src.half_vert[h]];
+        }
+        dst.verts[nv + ne + f] = sum / static_cast<float>(src.face_begin[f + 1] - src.face_begin[f]);
+    });
+
+    // edge points
+    he::Utility::ParallelForBlocks(ne, [&](size_t e)
+    {
+        const size_t h = src.edge_half[e];
+        const size_t t = src.half_twin[h];
+        auto& p0 = src.verts[src.half_vert[h]];
+        auto& p1 = src.verts[src.Dest(h)];
+        if (t == NONE) {
+            dst.verts[nv + e] = (p0 + p1) * 0.5f;
+        } else {
+            auto& f0 = dst.verts[nv + ne + src.half_face[h]];
+            auto& f1 = dst.verts[nv + ne + src.half_face[t]];
+            dst.verts[nv + e] = (p0 + p1 + f0 + f1) * 0.25f;
+        }
+    });
+
+    // vert points
+    VertRing ring(src);
+    he::Utility::ParallelForBlocks(nv, [&](size_t v)
+    {
+        if (ring.CalcBorderPos(src, v, dst.verts[v])) {
+            return;
+        }
+
+        const size_t n = ring.begin[v + 1] - ring.begin[v];
+        if (n == 0)
+        {
+            dst.verts[v] = src.verts[v];
+            return;
+        }
+
+        auto& p = src.verts[v];
+        sm::vec3 q, r;
+        for (size_t i = ring.begin[v]; i < ring.begin[v + 1]; ++i)
+        {
+            const size_t h = ring.halfs[i];
+            q += dst.verts[nv + ne + src.half_face[h]];
+            r += (p + src.verts[src.Dest(h)]) * 0.5f;
+        }
+        const float inv = 1.0f / n;
+        dst.verts[v] = (q * inv + r * (2 * inv) + p * (static_cast<float>(n) - 3)) * inv;
+    });
+
+    // topology, quad h: v, edge h, face, edge prev
+    dst.face_begin.resize(nh + 1);
+    dst.half_vert.resize(nh * 4);
+    dst.half_twin.resize(nh * 4);
+    he::Utility::ParallelForBlocks(nh, [&](size_t h)
+    {
+        const size_t prev = src.Prev(h);
+        const size_t next = src.Next(h);
+
+        dst.face_begin[h] = h * 4;
+
+        dst.half_vert[h * 4 + 0] = src.half_vert[h];
+        dst.half_vert[h * 4 + 1] = nv + src.half_edge[h];
+        dst.half_vert[h * 4 + 2] = nv + ne + src.half_face[h];
+        dst.half_vert[h * 4 + 3] = nv + src.half_edge[prev];
+
+        const size_t t = src.half_twin[h];
+        const size_t tp = src.half_twin[prev];
+        dst.half_twin[h * 4 + 0] = t == NONE ? NONE : src.Next(t) * 4 + 3;
+        dst.half_twin[h * 4 + 1] = next * 4 + 2;
+        dst.half_twin[h * 4 + 2] = prev * 4 + 1;
+        dst.half_twin[h * 4 + 3] = tp == NONE ? NONE : tp * 4 + 0;
+    });
+    dst.face_begin[nh] = nh * 4;
+
+    dst.BuildFaceOfHalfs();
+    dst.BuildEdges();
+
+    return dst;
+}
+
+// four triangles for each, the new verts are the old, then the edges,
+// the corner of half h is face h, the middle of face f is face nh + f
+FlatMesh LoopRefine(const FlatMesh& src)
+{
+    const size_t nv = src.verts.size();
+    const size_t ne = src.EdgeNum();
+    const size_t nf = src.FaceNum();
+    const size_t nh = src.HalfNum();
+
+    FlatMesh dst;
+    dst.verts.resize(nv + ne);
+
+    // edge points
+    he::Utility::ParallelForBlocks(ne, [&](size_t e)
+    {
+        const size_t h = src.edge_half[e];
+        const size_t t = src.half_twin[h];
+        auto& p0 = src.verts[src.half_vert[h]];
+        auto& p1 = src.verts[src.Dest(h)];
+        if (t == NONE) {
+            dst.verts[nv + e] = (p0 + p1) * 0.5f;
+        } else {
+            auto& o0 = src.verts[src.half_vert[src.Prev(h)]];
+            auto& o1 = src.verts[src.half_vert[src.Prev(t)]];
+            dst.verts[nv + e] = (p0 + p1) * (3.0f / 8) + (o0 + o1) * (1.0f / 8);
+        }
+    });
+
+    // vert points
+    VertRing ring(src);
+    he::Utility::ParallelForBlocks(nv, [&](size_t v)
+    {
+        if (ring.CalcBorderPos(src, v, dst.verts[v])) {
+            return;
+        }
+
+        const size_t n = ring.begin[v + 1] - ring.begin[v];
+        if (n == 0)
+        {
+            dst.verts[v] = src.verts[v];
+            return;
+        }
+
+        sm::vec3 sum;
+        for (size_t i = ring.begin[v]; i < ring.begin[v + 1]; ++i) {
+            sum += src.verts[src.Dest(ring.halfs[i])];
+        }
+        const float beta = n == 3 ? 3.0f / 16 : 3.0f / (8 * n);
+        dst.verts[v] = src.verts[v] * (1 - n * beta) + sum * beta;
+    });
+
+    // topology
+    dst.face_begin.resize(nh + nf + 1);
+    dst.half_vert.resize(nh * 3 + nf * 3);
+    dst.half_twin.resize(nh * 3 + nf * 3);
+    he::Utility::ParallelForBlocks(nh, [&](size_t h)
+    {
+        const size_t prev = src.Prev(h);
+        const size_t mid = nh * 3 + h;
+
+        // corner: v, edge h, edge prev
+        dst.face_begin[h] = h * 3;
+
+        dst.half_vert[h * 3 + 0] = src.half_vert[h];
+        dst.half_vert[h * 3 + 1] = nv + src.half_edge[h];
+        dst.half_vert[h * 3 + 2] = nv + src.half_edge[prev];
+
+        const size_t t = src.half_twin[h];
+        const size_t tp = src.half_twin[prev];
+        dst.half_twin[h * 3 + 0] = t == NONE ? NONE : src.Next(t) * 3 + 2;
+        dst.half_twin[h * 3 + 1] = mid;
+        dst.half_twin[h * 3 + 2] = tp == NONE ? NONE : tp * 3 + 0;
+
+        // middle: edge prev to edge h
+        dst.half_vert[mid] = nv + src.half_edge[prev];
+        dst.half_twin[mid] = h * 3 + 1;
+    });
+    for (size_t f = 0; f <= nf; ++f) {
+        dst.face_begin[nh + f] = nh * 3 + src.face_begin[f];
+    }
+
+    dst.BuildFaceOfHalfs();
+    dst.BuildEdges();
+
+    return dst;
+}
+
+}
+
+namespace he
+{
+
+PolyhedronPtr Polyhedron::Subdivide(SubdivideType type, size_t levels) const
+{
+    for (auto& face : m_faces)
+    {
+        if (!face.holes.empty()) {
+            return nullptr;
+        }
+        if (type == SubdivideType::Loop)
+        {
+            auto e = face.border->edge;
+            if (e->next->next->next != e) {
+                return nullptr;
+            }
+        }
+    }
+
+    auto mesh = BuildFlatMesh(*this);
+    for (size_t i = 0; i < levels; ++i)
+    {
+        switch (type)
+        {
+        case SubdivideType::CatmullClark:
+            mesh = CatmullClark(mesh);
+            break;
+        case SubdivideType::Loop:
+            mesh = LoopRefine(mesh);
+            break;
+        }
+    }
+
+    auto ret = std::make_shared<Polyhedron>();
+
+    const size_t nv = mesh.verts.size();
+    const size_t nh = mesh.HalfNum();
+    const size_t nf = mesh.FaceNum();
+
+    // the elements are made in parallel, then linked in order
+    std::vector<vert3*> verts(nv);
+    Utility::ParallelForBlocks(nv, [&](size_t i) {
+        verts[i] = new vert3(mesh.verts[i], i);
+    });
+
+    std::vector<edge3*> halfs(nh);
+    std::vector<loop3*> loops(nf);
+    Utility::ParallelForBlocks(nf, [&](size_t f)
+    {
+        auto loop = new loop3(f);
+        loops[f] = loop;
+
+        // the edge sets the vert's edge, the verts are shared
+        vert3 dummy(sm::vec3(), TopoID{});
+
+        edge3* prev = nullptr;
+        for (size_t h = mesh.face_begin[f]; h < mesh.face_begin[f + 1]; ++h)
+        {
+            halfs[h] = new edge3(&dummy, loop, h);
+            halfs[h]->vert = verts[mesh.half_vert[h]];
+            if (prev) {
+                prev->Connect(halfs[h]);
+            } else {
+                loop->edge = halfs[h];
+            }
+            prev = halfs[h];
+        }
+        prev->Connect(loop->edge);
+    });
+
+    // each writes its own
+    Utility::ParallelForBlocks(nh, [&](size_t h) {
+        const size_t t = mesh.half_twin[h];
+        halfs[h]->twin = t == NONE ? nullptr : halfs[t];
+    });
+
+    for (size_t h = 0; h < nh; ++h) {
+        halfs[h]->vert->edge = halfs[h];
+    }
+
+    for (auto& v : verts) {
+        ret->m_verts.Append(v);
+    }
+    for (auto& e : halfs) {
+        ret->m_edges.Append(e);
+    }
+    ret->m_faces.reserve(nf);
+    for (auto& l : loops)
+    {
+        ret->m_loops.Append(l);
+        ret->m_faces.emplace_back(l);
+    }
+
+    ret->m_next_vert_id = nv;
+    ret->m_next_edge_id = nh;
+    ret->m_next_loop_id = nf;
+
+    ret->SetAABBDirty();
+
+    return ret;
+}
+
+}
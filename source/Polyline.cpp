@@ -4,14 +4,11 @@
 #include <SM_Calc.h>
 
 #include <map>
+#include <unordered_map>
 
 namespace he
 {
 
-size_t Polyline::m_next_vert_id     = 0;
-size_t Polyline::m_next_edge_id     = 0;
-size_t Polyline::m_next_polyline_id = 0;
-
 Polyline::Polyline(const Polyline& poly)
 {
     this->operator = (poly);
@@ -157,6 +154,83 @@ void Polyline::UniquePoints()
     Utility::UniquePoints(m_vertices, m_edges, m_next_vert_id);
 }
 
+void Polyline::Smooth(size_t iterations, float lambda, float mu, bool lock_ends)
+{
+    const size_t num = m_vertices.Size();
+    if (num == 0 || iterations == 0) {
+        return;
+    }
+
+    std::unordered_map<const vert3*, size_t> vert2idx;
+    vert2idx.reserve(num);
+    std::vector<sm::vec3> pts;
+    pts.reserve(num);
+    auto first_v = m_vertices.Head();
+    auto curr_v = first_v;
+    do {
+        vert2idx.insert({ curr_v, pts.size() });
+        pts.push_back(curr_v->position);
+        curr_v = curr_v->linked_next;
+    } while (curr_v != first_v);
+
+    // the neighbors along the lines, each segment adds both ends
+    std::vector<std::pair<size_t, size_t>> links;
+    links.reserve(m_edges.Size() * 2);
+    std::vector<size_t> ring_begin(num + 1, 0);
+    auto first_e = m_edges.Head();
+    auto curr_e = first_e;
+    do {
+        if (curr_e->next)
+        {
+            const size_t v0 = vert2idx.find(curr_e->vert)->second;
+            const size_t v1 = vert2idx.find(curr_e->next->vert)->second;
+            if (v0 != v1)
+            {
+                links.push_back({ v0, v1 });
+                links.push_back({ v1, v0 });
+                ++ring_begin[v0 + 1];
+                ++ring_begin[v1 + 1];
+            }
+        }
+        curr_e = curr_e->linked_next;
+    } while (curr_e != first_e);
+
+    // the ends of open lines have a single neighbor, locked verts get empty rings
+    std::vector<bool> locked(num, false);
+    if (lock_ends) {
+        for (size_t i = 0; i < num; ++i) {
+            if (ring_begin[i + 1] == 1) {
+                locked[i] = true;
+                ring_begin[i + 1] = 0;
+            }
+        }
+    }
+    for (size_t i = 0; i < num; ++i) {
+        ring_begin[i + 1] += ring_begin[i];
+    }
+
+    std::vector<size_t> rings(ring_begin.back());
+    std::vector<size_t> cursor(ring_begin.begin(), ring_begin.end() - 1);
+    for (auto& l : links) {
+        if (!locked[l.first]) {
+            rings[cursor[l.first]++] = l.second;
+        }
+    }
+
+    std::vector<float> factors = { lambda };
+    if (mu != 0) {
+        factors.push_back(mu);
+    }
+    Utility::SmoothPoints(pts, ring_begin, rings, factors, iterations);
+
+    size_t idx = 0;
+    curr_v = first_v;
+    do {
+        curr_v->position = pts[idx++];
+        curr_v = curr_v->linked_next;
+    } while (curr_v != first_v);
+}
+
 void Polyline::OffsetTopoID(size_t v_off, size_t e_off, size_t f_off)
 {
     m_next_vert_id += v_off;
@@ -0,0 +1,146 @@
+#include "halfedge/TaskPool.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// the pool and queue of the worker running on this thread
+thread_local const he::TaskPool* t_pool = nullptr;
+thread_local size_t t_queue = 0;
+
+}
+
+namespace he
+{
+
+TaskPool::TaskPool(size_t thread_num)
+{
+    for (size_t i = 0; i <= thread_num; ++i) {
+        m_queues.emplace_back(new Queue());
+    }
+
+    m_threads.reserve(thread_num);
+    for (size_t i = 0; i < thread_num; ++i) {
+        m_threads.emplace_back(&TaskPool::WorkerLoop, this, i);
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (auto& t : m_threads) {
+        t.join();
+    }
+}
+
+void TaskPool::Run(Group& group, std::function<void()> task)
+{
+    ++group.m_pending;
+    ++m_pending;
+
+    auto& queue = *m_queues[QueryQueue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        queue.tasks.push_back({ std::move(task), &group });
+    }
+
+    // sync with a worker between its last pop and its wait
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+    }
+    m_cv.notify_one();
+}
+
+void TaskPool::Wait(Group& group)
+{
+    const size_t queue = QueryQueue();
+    while (group.m_pending > 0)
+    {
+        Task task;
+        if (Pop(queue, task))
+        {
+            task.func();
+            --task.group->m_pending;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+TaskPool& TaskPool::Instance()
+{
+    static TaskPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+size_t TaskPool::QueryQueue() const
+{
+    return t_pool == this ? t_queue : m_queues.size() - 1;
+}
+
+bool TaskPool::Pop(size_t queue, Task& task)
+{
+    // own queue lifo
+    {
+        auto& q = *m_queues[queue];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.tasks.empty())
+        {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            --m_pending;
+            return true;
+        }
+    }
+
+    // steal fifo, the oldest tasks are the largest
+    for (size_t i = 1, n = m_queues.size(); i < n; ++i)
+    {
+        auto& q = *m_queues[(queue + i) % n];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (!q.tasks.empty())
+        {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            --m_pending;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TaskPool::WorkerLoop(size_t queue)
+{
+    t_pool = this;
+    t_queue = queue;
+
+    while (true)
+    {
+        Task task;
+        if (Pop(queue, task))
+        {
+            task.func();
+            --task.group->m_pending;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cv.wait(lock, [&]() {
+            return m_stop || m_pending > 0;
+        });
+        if (m_stop && m_pending == 0) {
+            return;
+        }
+    }
+}
+
+}
\ No newline at end of file
@@ -3,6 +3,10 @@
 #include <SM_Calc.h>
 
 #include <set>
+#include <algorithm>
+#include <iterator>
+
+#include <float.h>
 
 namespace
 {
@@ -21,7 +25,389 @@ std::vector<sm::vec2> dump_vertices(const he::loop2& loop)
     return verts;
 }
 
-const float POINT_STATUS_EPSILON = 0.0001f;
+// error-free transformation, a + b == x + y exactly
+void two_sum(double a, double b, double& x, double& y)
+{
+    x = a + b;
+    const double b_virtual = x - a;
+    const double a_virtual = x - b_virtual;
+    y = (a - a_virtual) + (b - b_virtual);
+}
+
+// sign of the exact sum of the terms, Shewchuk's grow-expansion with zero elimination
+int exact_sum_sign(const double* terms, size_t num)
+{
+    double expansion[8];
+    assert(num <= 8);
+
+    size_t len = 0;
+    for (size_t i = 0; i < num; ++i)
+    {
+        double q = terms[i];
+        size_t k = 0;
+        for (size_t j = 0; j < len; ++j)
+        {
+            double h;
+            two_sum(q, expansion[j], q, h);
+            if (h != 0) {
+                expansion[k++] = h;
+            }
+        }
+        if (q != 0) {
+            expansion[k++] = q;
+        }
+        len = k;
+    }
+
+    // components are nonoverlapping and increasing, the last one decides the sign
+    if (len == 0) {
+        return 0;
+    }
+    return expansion[len - 1] > 0 ? 1 : -1;
+}
+
+// float * float is exact in double, so only the sums round
+const double FILTER_ERROR_BOUND = 8 * DBL_EPSILON;
+
+// unlinked ear clipper node
+const size_t NONE = static_cast<size_t>(-1);
+
+// ear clipping on rings of nodes, the holes are bridged into the border ring
+class EarClipper
+{
+public:
+    EarClipper(const std::vector<sm::vec2>& pts)
+        : m_pts(pts)
+    {
+    }
+
+    // ccw, reversed if not
+    size_t AddRing(size_t begin, size_t end, bool ccw)
+    {
+        double area = 0;
+        for (size_t i = begin; i < end; ++i) {
+            auto& p0 = m_pts[i];
+            auto& p1 = m_pts[i + 1 == end ? begin : i + 1];
+            area += static_cast<double>(p0.x) * p1.y - static_cast<double>(p1.x) * p0.y;
+        }
+        const bool reverse = ccw ? area < 0 : area > 0;
+
+        const size_t first = m_idx.size();
+        const size_t n = end - begin;
+        for (size_t i = 0; i < n; ++i)
+        {
+            m_idx.push_back(reverse ? end - 1 - i : begin + i);
+            m_prev.push_back(first + (i + n - 1) % n);
+            m_next.push_back(first + (i + 1) % n);
+        }
+        return first;
+    }
+
+    // rightmost vert of the hole to the nearest border vert seen along +x,
+    // false if there is none, the hole is not inside the border
+    bool Bridge(size_t outer, size_t hole)
+    {
+        size_t m = hole;
+        for (size_t n = m_next[hole]; n != hole; n = m_next[n]) {
+            if (Pos(n).x > Pos(m).x) {
+                m = n;
+            }
+        }
+        auto& mp = Pos(m);
+
+        size_t p = NONE;
+        float qx = FLT_MAX;
+        size_t a = outer;
+        do {
+            const size_t b = m_next[a];
+            auto& pa = Pos(a);
+            auto& pb = Pos(b);
+            if (pa.y <= mp.y && mp.y <= pb.y && pa.y != pb.y)
+            {
+                const float x = pa.x + (mp.y - pa.y) * (pb.x - pa.x) / (pb.y - pa.y);
+                if (x >= mp.x && x < qx) {
+                    qx = x;
+                    p = pa.x > pb.x ? a : b;
+                }
+            }
+            a = b;
+        } while (a != outer);
+        if (p == NONE) {
+            return false;
+        }
+
+        // the verts in the triangle block the ray, take the one closest in angle
+        if (qx != mp.x)
+        {
+            const sm::vec2 ip(qx, mp.y);
+            const sm::vec2 pp = Pos(p);
+            const bool up = pp.y > mp.y;
+            float best = FLT_MAX;
+            size_t n = outer;
+            do {
+                auto& np = Pos(n);
+                if (n != p && np.x >= mp.x && IsPointInTriangle(np, up ? mp : ip, up ? ip : mp, pp))
+                {
+                    const float tan = std::abs(np.y - mp.y) / std::max(np.x - mp.x, FLT_MIN);
+                    if (tan < best) {
+                        best = tan;
+                        p = n;
+                    }
+                }
+                n = m_next[n];
+            } while (n != outer);
+        }
+
+        Split(p, m);
+        return true;
+    }
+
+    void Clip(size_t start, std::vector<size_t>& tris)
+    {
+        size_t n = 1;
+        for (size_t i = m_next[start]; i != start; i = m_next[i]) {
+            ++n;
+        }
+
+        size_t ear = start;
+        size_t stop = ear;
+        int pass = 0;
+        while (n > 3)
+        {
+            const size_t prev = m_prev[ear];
+            const size_t next = m_next[ear];
+
+            // convex ears first, then flat, then anything left
+            bool clip = false;
+            const double area = Area(prev, ear, next);
+            switch (pass)
+            {
+            case 0:
+                clip = area > 0 && IsEar(prev, ear, next);
+                break;
+            case 1:
+                clip = area >= 0;
+                break;
+            default:
+                clip = true;
+                break;
+            }
+
+            if (clip)
+            {
+                tris.push_back(m_idx[prev]);
+                tris.push_back(m_idx[ear]);
+                tris.push_back(m_idx[next]);
+
+                m_next[prev] = next;
+                m_prev[next] = prev;
+                --n;
+
+                ear = next;
+                stop = next;
+                pass = 0;
+                continue;
+            }
+
+            ear = next;
+            if (ear == stop) {
+                ++pass;
+            }
+        }
+
+        tris.push_back(m_idx[m_prev[ear]]);
+        tris.push_back(m_idx[ear]);
+        tris.push_back(m_idx[m_next[ear]]);
+    }
+
+private:
+    const sm::vec2& Pos(size_t n) const {
+        return m_pts[m_idx[n]];
+    }
+
+    double Area(size_t a, size_t b, size_t c) const
+    {
+        auto& pa = Pos(a);
+        auto& pb = Pos(b);
+        auto& pc = Pos(c);
+        return (static_cast<double>(pb.x) - pa.x) * (static_cast<double>(pc.y) - pb.y)
+             - (static_cast<double>(pb.y) - pa.y) * (static_cast<double>(pc.x) - pb.x);
+    }
+
+    static bool IsPointInTriangle(const sm::vec2& p, const sm::vec2& a, const sm::vec2& b, const sm::vec2& c)
+    {
+        auto cross = [](const sm::vec2& o, const sm::vec2& s, const sm::vec2& t) {
+            return (static_cast<double>(s.x) - o.x) * (static_cast<double>(t.y) - o.y)
+                 - (static_cast<double>(s.y) - o.y) * (static_cast<double>(t.x) - o.x);
+        };
+        return cross(a, b, p) >= 0 && cross(b, c, p) >= 0 && cross(c, a, p) >= 0;
+    }
+
+    // no other vert in the triangle, the ones on the corners are skipped
+    bool IsEar(size_t a, size_t b, size_t c) const
+    {
+        auto& pa = Pos(a);
+        auto& pb = Pos(b);
+        auto& pc = Pos(c);
+        for (size_t n = m_next[c]; n != a; n = m_next[n])
+        {
+            auto& p = Pos(n);
+            if (p == pa || p == pb || p == pc) {
+                continue;
+            }
+            if (IsPointInTriangle(p, pa, pb, pc)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // a to b, the ring is cut in two joined by the copies
+    void Split(size_t a, size_t b)
+    {
+        const size_t a2 = Copy(a);
+        const size_t b2 = Copy(b);
+        const size_t an = m_next[a];
+        const size_t bp = m_prev[b];
+
+        m_next[a] = b;
+        m_prev[b] = a;
+
+        m_next[a2] = an;
+        m_prev[an] = a2;
+
+        m_next[b2] = a2;
+        m_prev[a2] = b2;
+
+        m_next[bp] = b2;
+        m_prev[b2] = bp;
+    }
+
+    size_t Copy(size_t n)
+    {
+        m_idx.push_back(m_idx[n]);
+        m_prev.push_back(NONE);
+        m_next.push_back(NONE);
+        return m_idx.size() - 1;
+    }
+
+private:
+    const std::vector<sm::vec2>& m_pts;
+
+    // by node, a point may have more nodes after bridging
+    std::vector<size_t> m_idx;
+    std::vector<size_t> m_prev, m_next;
+
+}; // EarClipper
+
+// the face plane's basis, the border is ccw in it
+void project_loops(const he::Polyhedron::Face& face, std::vector<sm::vec2>& pts, std::vector<size_t>& sizes)
+{
+    sm::Plane plane;
+    he::Utility::LoopToPlane(*face.border, plane);
+    auto& n = plane.normal;
+
+    const sm::vec3 axis = std::abs(n.x) < 0.6f ? sm::vec3(1, 0, 0) : sm::vec3(0, 1, 0);
+    auto u = axis.Cross(n);
+    u.Normalize();
+    auto v = n.Cross(u);
+
+    auto add_loop = [&](const he::loop3& loop)
+    {
+        const size_t begin = pts.size();
+        auto first_e = loop.edge;
+        auto curr_e = first_e;
+        do {
+            auto& p = curr_e->vert->position;
+            pts.push_back(sm::vec2(p.Dot(u), p.Dot(v)));
+            curr_e = curr_e->next;
+        } while (curr_e != first_e);
+        sizes.push_back(pts.size() - begin);
+    };
+    add_loop(*face.border);
+    for (auto& hole : face.holes) {
+        add_loop(*hole);
+    }
+}
+
+void dump_loops(const he::Polygon::Face& face, std::vector<sm::vec2>& pts, std::vector<size_t>& sizes)
+{
+    auto add_loop = [&](const he::loop2& loop)
+    {
+        auto verts = dump_vertices(loop);
+        std::copy(verts.begin(), verts.end(), std::back_inserter(pts));
+        sizes.push_back(verts.size());
+    };
+    add_loop(*face.border);
+    for (auto& hole : face.holes) {
+        add_loop(*hole);
+    }
+}
+
+void triangulate(const std::vector<sm::vec2>& pts, const std::vector<size_t>& sizes, std::vector<size_t>& tris)
+{
+    assert(!sizes.empty());
+
+    const size_t nb = sizes[0];
+    if (nb < 3) {
+        return;
+    }
+
+    // fan for the convex border
+    if (sizes.size() == 1)
+    {
+        bool convex = true;
+        for (size_t i = 0; i < nb && convex; ++i)
+        {
+            auto& p0 = pts[(i + nb - 1) % nb];
+            auto& p1 = pts[i];
+            auto& p2 = pts[(i + 1) % nb];
+            const double cross = (static_cast<double>(p1.x) - p0.x) * (static_cast<double>(p2.y) - p1.y)
+                               - (static_cast<double>(p1.y) - p0.y) * (static_cast<double>(p2.x) - p1.x);
+            convex = cross > 0;
+        }
+        if (convex)
+        {
+            tris.reserve(tris.size() + (nb - 2) * 3);
+            for (size_t i = 1; i + 1 < nb; ++i) {
+                tris.push_back(0);
+                tris.push_back(i);
+                tris.push_back(i + 1);
+            }
+            return;
+        }
+    }
+
+    EarClipper clipper(pts);
+    const size_t outer = clipper.AddRing(0, nb, true);
+
+    // from right to left, each is bridged to the rings joined so far
+    std::vector<std::pair<float, size_t>> holes;
+    size_t begin = nb;
+    for (size_t i = 1, n = sizes.size(); i < n; ++i)
+    {
+        if (sizes[i] >= 3)
+        {
+            const size_t node = clipper.AddRing(begin, begin + sizes[i], false);
+            float max_x = -FLT_MAX;
+            for (size_t j = begin; j < begin + sizes[i]; ++j) {
+                max_x = std::max(max_x, pts[j].x);
+            }
+            holes.push_back({ max_x, node });
+        }
+        begin += sizes[i];
+    }
+    std::sort(holes.begin(), holes.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) {
+        return a.first > b.first;
+    });
+    for (auto& hole : holes) {
+        if (!clipper.Bridge(outer, hole.second)) {
+            return;
+        }
+    }
+
+    clipper.Clip(outer, tris);
+}
 
 }
 
@@ -66,6 +452,51 @@ void Utility::LoopToPlane(const loop3& loop, sm::Plane& plane)
     plane.Build(normal, first_edge->vert->position);
 }
 
+void Utility::SplitPolygon(const std::vector<sm::vec3>& polygon, const sm::Plane& plane,
+                           std::vector<sm::vec3>& above, std::vector<sm::vec3>& below)
+{
+    above.clear();
+    below.clear();
+
+    const size_t n = polygon.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto& p0 = polygon[i];
+        auto& p1 = polygon[(i + 1) % n];
+        auto s0 = CalcPointPlaneStatus(plane, p0);
+        auto s1 = CalcPointPlaneStatus(plane, p1);
+
+        if (s0 != PointStatus::Below) {
+            above.push_back(p0);
+        }
+        if (s0 != PointStatus::Above) {
+            below.push_back(p0);
+        }
+
+        if ((s0 == PointStatus::Above && s1 == PointStatus::Below) ||
+            (s0 == PointStatus::Below && s1 == PointStatus::Above))
+        {
+            const double d0 = CalcPointPlaneDistance(plane, p0);
+            const double d1 = CalcPointPlaneDistance(plane, p1);
+            const double t = d0 / (d0 - d1);
+            sm::vec3 p(
+                static_cast<float>(p0.x + (p1.x - p0.x) * t),
+                static_cast<float>(p0.y + (p1.y - p0.y) * t),
+                static_cast<float>(p0.z + (p1.z - p0.z) * t)
+            );
+            above.push_back(p);
+            below.push_back(p);
+        }
+    }
+
+    if (above.size() < 3) {
+        above.clear();
+    }
+    if (below.size() < 3) {
+        below.clear();
+    }
+}
+
 sm::vec3 Utility::CalcLoopNorm(const loop3& loop)
 {
     sm::Plane plane;
@@ -73,6 +504,22 @@ sm::vec3 Utility::CalcLoopNorm(const loop3& loop)
     return plane.normal;
 }
 
+void Utility::TriangulateFace(const Polyhedron::Face& face, std::vector<size_t>& tris)
+{
+    std::vector<sm::vec2> pts;
+    std::vector<size_t> sizes;
+    project_loops(face, pts, sizes);
+    triangulate(pts, sizes, tris);
+}
+
+void Utility::TriangulateFace(const Polygon::Face& face, std::vector<size_t>& tris)
+{
+    std::vector<sm::vec2> pts;
+    std::vector<size_t> sizes;
+    dump_loops(face, pts, sizes);
+    triangulate(pts, sizes, tris);
+}
+
 sm::vec3 Utility::CalcFaceNorm(const Polyhedron::Face& face)
 {
     if (face.border) {
@@ -85,17 +532,80 @@ sm::vec3 Utility::CalcFaceNorm(const Polyhedron::Face& face)
     }
 }
 
+void Utility::SmoothPoints(std::vector<sm::vec3>& pts, const std::vector<size_t>& ring_begin,
+                           const std::vector<size_t>& rings, const std::vector<float>& factors, size_t iterations)
+{
+    assert(ring_begin.size() == pts.size() + 1);
+
+    std::vector<sm::vec3> buf(pts);
+    auto src = &pts;
+    auto dst = &buf;
+    for (size_t i = 0; i < iterations; ++i)
+    {
+        for (auto f : factors)
+        {
+            ParallelForBlocks(pts.size(), [&](size_t j)
+            {
+                auto& p = (*src)[j];
+                const size_t begin = ring_begin[j], n = ring_begin[j + 1] - begin;
+                if (n == 0) {
+                    (*dst)[j] = p;
+                    return;
+                }
+
+                sm::vec3 sum;
+                for (size_t k = begin; k < begin + n; ++k) {
+                    sum += (*src)[rings[k]];
+                }
+                (*dst)[j] = p + (sum / static_cast<float>(n) - p) * f;
+            });
+            std::swap(src, dst);
+        }
+    }
+
+    if (src != &pts) {
+        pts.swap(buf);
+    }
+}
+
+double Utility::CalcPointPlaneDistance(const sm::Plane& plane, const sm::vec3& pos)
+{
+    return static_cast<double>(plane.normal.x) * pos.x
+         + static_cast<double>(plane.normal.y) * pos.y
+         + static_cast<double>(plane.normal.z) * pos.z
+         + plane.dist;
+}
+
 Utility::PointStatus 
 Utility::CalcPointPlaneStatus(const sm::Plane& plane, const sm::vec3& pos)
 {
-    const float dist = plane.GetDistance(pos);
-    if (dist > POINT_STATUS_EPSILON) {
+    const double px = static_cast<double>(plane.normal.x) * pos.x;
+    const double py = static_cast<double>(plane.normal.y) * pos.y;
+    const double pz = static_cast<double>(plane.normal.z) * pos.z;
+    const double pd = plane.dist;
+    const double eps = POINT_STATUS_EPSILON;
+
+    // filter
+    const double dist = px + py + pz + pd;
+    const double err = FILTER_ERROR_BOUND * (fabs(px) + fabs(py) + fabs(pz) + fabs(pd) + eps);
+    if (dist - eps > err) {
         return PointStatus::Above;
-    } else if (dist < -POINT_STATUS_EPSILON) {
+    } else if (dist + eps < -err) {
         return PointStatus::Below;
-    } else {
+    } else if (fabs(dist) + err < eps) {
         return PointStatus::Inside;
     }
+
+    // exact
+    const double above[] = { px, py, pz, pd, -eps };
+    if (exact_sum_sign(above, 5) > 0) {
+        return PointStatus::Above;
+    }
+    const double below[] = { px, py, pz, pd, eps };
+    if (exact_sum_sign(below, 5) < 0) {
+        return PointStatus::Below;
+    }
+    return PointStatus::Inside;
 }
 
 Utility::FaceStatus 
@@ -149,4 +659,104 @@ Utility::CalcFacePlaneStatus(const Polyhedron::Face& face, const sm::Plane& plan
     }
 }
 
+Utility::FaceStatus
+Utility::CalcPolyhedronPlaneStatus(const Polyhedron& poly, const sm::Plane& plane)
+{
+    bool above = false, below = false;
+
+    auto first_v = poly.GetVerts().Head();
+    auto curr_v = first_v;
+    if (curr_v)
+    {
+        do {
+            switch (CalcPointPlaneStatus(plane, curr_v->position))
+            {
+            case PointStatus::Above:
+                above = true;
+                break;
+            case PointStatus::Below:
+                below = true;
+                break;
+            default:
+                break;
+            }
+            if (above && below) {
+                return FaceStatus::Cross;
+            }
+            curr_v = curr_v->linked_next;
+        } while (curr_v != first_v);
+    }
+
+    if (above) {
+        return FaceStatus::Above;
+    } else if (below) {
+        return FaceStatus::Below;
+    } else {
+        return FaceStatus::Inside;
+    }
+}
+
+Utility::PointStatus
+Utility::CalcAABBPlaneStatus(const sm::cube& aabb, const sm::Plane& plane)
+{
+    if (!aabb.IsValid()) {
+        return PointStatus::Inside;
+    }
+
+    // the distance is linear, the inner points lie between the corners'
+    bool above = false, below = false;
+    for (int i = 0; i < 8; ++i)
+    {
+        sm::vec3 corner(
+            i & 1 ? aabb.max[0] : aabb.min[0],
+            i & 2 ? aabb.max[1] : aabb.min[1],
+            i & 4 ? aabb.max[2] : aabb.min[2]
+        );
+        switch (CalcPointPlaneStatus(plane, corner))
+        {
+        case PointStatus::Above:
+            above = true;
+            break;
+        case PointStatus::Below:
+            below = true;
+            break;
+        default:
+            break;
+        }
+        if (above && below) {
+            return PointStatus::Inside;
+        }
+    }
+
+    if (above) {
+        return PointStatus::Above;
+    } else if (below) {
+        return PointStatus::Below;
+    } else {
+        return PointStatus::Inside;
+    }
+}
+
+bool Utility::IsAABBOverlap(const sm::cube& a, const sm::cube& b)
+{
+    if (!a.IsValid() || !b.IsValid()) {
+        return false;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        if (a.max[i] <= b.min[i] + POINT_STATUS_EPSILON ||
+            b.max[i] <= a.min[i] + POINT_STATUS_EPSILON) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Utility::IsPointOnAABB(const sm::cube& aabb, const sm::vec3& pos)
+{
+    return pos.x <= aabb.min[0] || pos.x >= aabb.max[0] ||
+           pos.y <= aabb.min[1] || pos.y >= aabb.max[1] ||
+           pos.z <= aabb.min[2] || pos.z >= aabb.max[2];
+}
+
 }
\ No newline at end of file